@@ -0,0 +1,148 @@
+#ifndef __DEBOUNCER_H__
+#define __DEBOUNCER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include "PackedKeyState.h"
+
+/**
+ * Turns raw scans into debounced key state.
+ *
+ * update() is called once per scan with the raw matrix and current time (ms).
+ * Keys whose debounced state changed are set in `changed`, new state is state().
+ * Only state kept by the algorithm is touched, so all of them work on
+ * PackedKeyState words and visit single keys only with countTrailingZeros.
+ *
+ * Implementations:
+ *   FilterDebouncer   press after 2 agreeing scans, release immediately (original filter)
+ *   EagerDebouncer    press immediately, release after releaseTime ms without contact
+ *   CounterDebouncer  either edge after 4 agreeing scans
+ */
+template <uint8_t ROWS, uint8_t COLS>
+class Debouncer {
+public:
+	typedef PackedKeyState<ROWS, COLS> KeyState;
+
+protected:
+	KeyState debounced;
+
+public:
+	Debouncer() {
+		debounced.clear();
+	}
+
+	virtual ~Debouncer() {}
+
+	virtual void update(const KeyState& raw, const uint32_t now, KeyState& changed) = 0;
+
+	const KeyState& state() const {
+		return debounced;
+	}
+};
+
+/**
+ * (~(prev ^ curr) & curr) of the original main loop:
+ * a press must be seen on 2 scans in a row, a release is taken at once.
+ * Latency of a press is one scan interval.
+ */
+template <uint8_t ROWS, uint8_t COLS>
+class FilterDebouncer : public Debouncer<ROWS, COLS> {
+	typedef Debouncer<ROWS, COLS> Base;
+	typename Base::KeyState prev;
+
+public:
+	FilterDebouncer() {
+		prev.clear();
+	}
+
+	virtual void update(const typename Base::KeyState& raw, const uint32_t now, typename Base::KeyState& changed) {
+		for (int word = 0; word < Base::KeyState::WORDS; word++) {
+			const uint32_t filtered = (~(prev.words[word] ^ raw.words[word]) & raw.words[word]);
+			changed.words[word] = this->debounced.words[word] ^ filtered;
+			this->debounced.words[word] = filtered;
+			prev.words[word] = raw.words[word];
+		}
+	}
+};
+
+/**
+ * Eager on press, deferred on release (per-key timer).
+ *
+ * A contact is reported as press on the first scan. Bounce after that is
+ * ignored until the key has read released for releaseTime ms, so
+ * press latency is zero and chatter on release is absorbed by the timer.
+ */
+template <uint8_t ROWS, uint8_t COLS>
+class EagerDebouncer : public Debouncer<ROWS, COLS> {
+	typedef Debouncer<ROWS, COLS> Base;
+
+	// last time (ms, low 16bit) the key read pressed
+	uint16_t lastContact[Base::KeyState::BITS];
+	uint16_t releaseTime;
+
+public:
+	EagerDebouncer(const uint16_t _releaseTime = 5) :
+		releaseTime(_releaseTime)
+	{
+		memset(lastContact, 0, sizeof(lastContact));
+	}
+
+	virtual void update(const typename Base::KeyState& raw, const uint32_t now, typename Base::KeyState& changed) {
+		for (int word = 0; word < Base::KeyState::WORDS; word++) {
+			uint32_t& debounced = this->debounced.words[word];
+			changed.words[word] = 0;
+
+			// only keys reading pressed or held pressed need a look
+			uint32_t active = raw.words[word] | debounced;
+			while (active) {
+				const uint8_t bit = Base::KeyState::countTrailingZeros(active);
+				const uint32_t mask = 1UL<<bit;
+				active &= active - 1;
+
+				uint16_t& contact = lastContact[word * 32 + bit];
+				if (raw.words[word] & mask) {
+					contact = now;
+					if (!(debounced & mask)) {
+						debounced |= mask;
+						changed.words[word] |= mask;
+					}
+				} else if (static_cast<uint16_t>(now - contact) >= releaseTime) {
+					debounced &= ~mask;
+					changed.words[word] |= mask;
+				}
+			}
+		}
+	}
+};
+
+/**
+ * Symmetric: the debounced state flips after 4 scans in a row disagree with it.
+ * 2-bit counters are kept vertically (ct0: bit 0, ct1: bit 1 of all keys),
+ * so every key is counted with a few word operations.
+ */
+template <uint8_t ROWS, uint8_t COLS>
+class CounterDebouncer : public Debouncer<ROWS, COLS> {
+	typedef Debouncer<ROWS, COLS> Base;
+	typename Base::KeyState ct0;
+	typename Base::KeyState ct1;
+
+public:
+	CounterDebouncer() {
+		ct0.clear();
+		ct1.clear();
+	}
+
+	virtual void update(const typename Base::KeyState& raw, const uint32_t now, typename Base::KeyState& changed) {
+		for (int word = 0; word < Base::KeyState::WORDS; word++) {
+			// counter is cleared where raw agrees with debounced
+			const uint32_t delta = raw.words[word] ^ this->debounced.words[word];
+			ct1.words[word] = (ct1.words[word] ^ ct0.words[word]) & delta;
+			ct0.words[word] = ~ct0.words[word] & delta;
+			// 0 -> 1 -> 2 -> 3 -> 0 wrapped: 4th disagreeing scan
+			changed.words[word] = delta & ~(ct0.words[word] | ct1.words[word]);
+			this->debounced.words[word] ^= changed.words[word];
+		}
+	}
+};
+
+#endif
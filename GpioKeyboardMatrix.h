@@ -0,0 +1,70 @@
+#ifndef __GPIO_KEYBOARD_MATRIX_H__
+#define __GPIO_KEYBOARD_MATRIX_H__
+
+#include "mbed.h"
+#include "KeyboardMatrix.h"
+
+/**
+ * Matrix wired directly to LPC11U35 pins.
+ *
+ * COL: open drain. The active column is driven low, others are high-Z
+ *      so that pressing keys on two columns never shorts outputs.
+ * ROW: input pulled-up (pressed = low)
+ *
+ * gpio_t (mbed HAL) is used instead of DigitalInOut to keep pins in plain arrays.
+ */
+class GpioKeyboardMatrix : public KeyboardMatrix {
+	static const uint8_t MAX_COLS = 16;
+	static const uint8_t MAX_ROWS = 8;
+
+	const PinName* colPins;
+	const PinName* rowPins;
+	const uint8_t colCount;
+	const uint8_t rowCount;
+
+	gpio_t colGpio[MAX_COLS];
+	gpio_t rowGpio[MAX_ROWS];
+
+public:
+	GpioKeyboardMatrix(const PinName* _colPins, const uint8_t _cols, const PinName* _rowPins, const uint8_t _rows) :
+		colPins(_colPins),
+		rowPins(_rowPins),
+		colCount(_cols < MAX_COLS ? _cols : MAX_COLS),
+		rowCount(_rows < MAX_ROWS ? _rows : MAX_ROWS)
+	{
+	}
+
+	virtual void init() {
+		for (int i = 0; i < rowCount; i++) {
+			gpio_init_in(&rowGpio[i], rowPins[i]);
+			gpio_mode(&rowGpio[i], PullUp);
+		}
+		for (int i = 0; i < colCount; i++) {
+			gpio_init_inout(&colGpio[i], colPins[i], PIN_INPUT, PullNone, 0);
+		}
+	}
+
+	virtual void scan(uint8_t* keys) {
+		for (int col = 0; col < colCount; col++) {
+			gpio_dir(&colGpio[col], PIN_OUTPUT);
+			gpio_write(&colGpio[col], 0);
+			wait_us(1);
+
+			uint8_t rows = 0;
+			for (int row = 0; row < rowCount; row++) {
+				if (!gpio_read(&rowGpio[row])) {
+					rows |= 1<<row;
+				}
+			}
+			keys[col] = rows;
+
+			gpio_dir(&colGpio[col], PIN_INPUT);
+		}
+	}
+
+	virtual uint8_t cols() const {
+		return colCount;
+	}
+};
+
+#endif
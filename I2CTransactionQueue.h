@@ -0,0 +1,204 @@
+#ifndef __I2C_TRANSACTION_QUEUE_H__
+#define __I2C_TRANSACTION_QUEUE_H__
+
+#include "mbed.h"
+
+/**
+ * One register access to an I2C slave:
+ *   START, SLA+W, tx[0..txLength), (repeated START, SLA+R, rx[0..rxLength)), STOP
+ *
+ * callback is called in ISR context when the transaction is finished.
+ * status is 0 on success (same as mbed I2C::write/read).
+ */
+struct I2CTransaction {
+	typedef void (*callback_t)(void* context, const I2CTransaction& transaction);
+
+	uint8_t address; // 8-bit address (7-bit address << 1)
+	uint8_t txLength;
+	uint8_t rxLength;
+	uint8_t tx[3];
+	uint8_t rx[2];
+	int8_t status;
+	callback_t callback;
+	void* context;
+};
+
+/**
+ * Interrupt driven I2C master for LPC11U.
+ *
+ * Transactions are prepared in a fixed size ring and submitted back-to-back
+ * from I2C_IRQHandler (STOP and next START are issued at once), so the CPU
+ * is free while a whole scan is on the bus.
+ *
+ * The peripheral itself (pins, frequency) is set up by mbed I2C.
+ * Blocking mbed I2C calls must not be used while !idle(): the ISR owns SI
+ * and I2C_IRQn is enabled only while transactions are queued.
+ *
+ * Usage:
+ *   I2CTransaction* t = queue.reserve();
+ *   if (t) { fill t; queue.commit(); }
+ *
+ * reserve()/commit() may also be called from a transaction callback (ISR)
+ * to chain more transactions, as long as main context is not queueing at the same time.
+ */
+class I2CTransactionQueue {
+	// must be power of 2
+	static const uint8_t SIZE = 32;
+
+	// I2CONSET / I2CONCLR
+	static const uint32_t AA = 1<<2;
+	static const uint32_t SI = 1<<3;
+	static const uint32_t STO = 1<<4;
+	static const uint32_t STA = 1<<5;
+
+	I2CTransaction ring[SIZE];
+	// head: next slot to be submitted (main context)
+	// tail: transaction on the bus (ISR context)
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	volatile bool busy;
+	uint8_t txPos;
+	uint8_t rxPos;
+
+	static I2CTransactionQueue*& instance() {
+		static I2CTransactionQueue* queue = NULL;
+		return queue;
+	}
+
+	void finish(const int8_t status) {
+		I2CTransaction& t = ring[tail];
+		t.status = status;
+		tail = (tail + 1) & (SIZE - 1);
+
+		if (tail != head) {
+			// STOP then START of the next transaction
+			txPos = rxPos = 0;
+			LPC_I2C->CONSET = STO | STA;
+		} else {
+			busy = false;
+			NVIC_DisableIRQ(I2C_IRQn);
+			LPC_I2C->CONSET = STO;
+		}
+		LPC_I2C->CONCLR = SI;
+
+		if (t.callback) {
+			t.callback(t.context, t);
+		}
+	}
+
+	void isr() {
+		I2CTransaction& t = ring[tail];
+		switch (LPC_I2C->STAT) {
+			case 0x08: // START transmitted
+			case 0x10: // repeated START transmitted
+				LPC_I2C->DAT = (txPos < t.txLength) ? t.address : (t.address | 1);
+				LPC_I2C->CONCLR = STA;
+				break;
+
+			case 0x18: // SLA+W transmitted, ACK received
+			case 0x28: // data transmitted, ACK received
+				if (txPos < t.txLength) {
+					LPC_I2C->DAT = t.tx[txPos++];
+				} else if (t.rxLength) {
+					LPC_I2C->CONSET = STA;
+				} else {
+					finish(0);
+					return;
+				}
+				break;
+
+			case 0x40: // SLA+R transmitted, ACK received
+				if (t.rxLength > 1) {
+					LPC_I2C->CONSET = AA;
+				} else {
+					LPC_I2C->CONCLR = AA;
+				}
+				break;
+
+			case 0x50: // data received, ACK returned
+				t.rx[rxPos++] = LPC_I2C->DAT;
+				if (rxPos + 1 < t.rxLength) {
+					LPC_I2C->CONSET = AA;
+				} else {
+					LPC_I2C->CONCLR = AA;
+				}
+				break;
+
+			case 0x58: // data received, NACK returned
+				t.rx[rxPos++] = LPC_I2C->DAT;
+				finish(0);
+				return;
+
+			default: // NACK (0x20, 0x30, 0x48), arbitration lost (0x38), bus error
+				finish(-1);
+				return;
+		}
+		LPC_I2C->CONCLR = SI;
+	}
+
+public:
+	/**
+	 * I2C interrupt handler, installed by commit()
+	 */
+	static void irq() {
+		instance()->isr();
+	}
+
+	I2CTransactionQueue() :
+		head(0),
+		tail(0),
+		busy(false),
+		txPos(0),
+		rxPos(0)
+	{
+		instance() = this;
+	}
+
+	/**
+	 * Returns next free slot or NULL when the ring is full.
+	 * The slot is not submitted until commit().
+	 */
+	I2CTransaction* reserve() {
+		const uint8_t next = (head + 1) & (SIZE - 1);
+		if (next == tail) {
+			return NULL;
+		}
+		I2CTransaction* t = &ring[head];
+		t->txLength = 0;
+		t->rxLength = 0;
+		t->status = 0;
+		t->callback = NULL;
+		t->context = NULL;
+		return t;
+	}
+
+	void commit() {
+		const uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		head = (head + 1) & (SIZE - 1);
+		if (!busy) {
+			busy = true;
+			txPos = rxPos = 0;
+			NVIC_SetVector(I2C_IRQn, (uint32_t)&irq);
+			NVIC_EnableIRQ(I2C_IRQn);
+			LPC_I2C->CONSET = STA;
+		}
+		__set_PRIMASK(primask);
+	}
+
+	/**
+	 * Number of slots reserve() can still return
+	 */
+	uint8_t available() const {
+		return (SIZE - 1) - ((head - tail) & (SIZE - 1));
+	}
+
+	/**
+	 * true when all submitted transactions are finished
+	 */
+	bool idle() const {
+		return !busy;
+	}
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __KEYBOARD_MATRIX_H__
+#define __KEYBOARD_MATRIX_H__
+
+#include <stdint.h>
+
+/**
+ * Source of the key matrix state.
+ *
+ * scan() fills keys[0..cols()) with one byte per column, bit N is row N
+ * (1: pressed). This is the format main.cpp debounces on.
+ *
+ * Implementations:
+ *   KeyboardMatrixController  MCP23017s (up to 8) on I2C
+ *   GpioKeyboardMatrix        rows/cols wired to LPC11U35 pins
+ *   SimulatedKeyboardMatrix   scripted key events (no hardware, builds on host)
+ */
+class KeyboardMatrix {
+public:
+	virtual ~KeyboardMatrix() {}
+
+	virtual void init() = 0;
+	virtual void scan(uint8_t* keys) = 0;
+	virtual uint8_t cols() const = 0;
+};
+
+#endif
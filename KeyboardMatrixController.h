@@ -1,15 +1,93 @@
 #include "config.h"
 #include "mcp23017.h"
+#include "KeyboardMatrix.h"
+
+/**
+ * Key matrix on EXPANDERS MCP23017 sharing one I2C bus (up to 8, address 0x20-0x27).
+ * Expander n drives columns n*8 .. n*8+7, so the matrix is EXPANDERS*8 columns x 8 rows
+ * in the usual one byte per column format.
+ */
+template <uint8_t EXPANDERS>
+class KeyboardMatrixController : public KeyboardMatrix {
+public:
+	/**
+	 * SCAN_MODE_BYTE: write GPIOA and read GPIOB separately (2 transactions per column)
+	 * SCAN_MODE_BATCHED: drive GPIOA and read GPIOB with one repeated-start transaction
+	 *
+	 * In both modes expanders are interleaved column by column and there is
+	 * no settle wait: a row read always follows its column drive by at least
+	 * one address phase on the bus (>20us at 400kHz).
+	 */
+	enum ScanMode {
+		SCAN_MODE_BYTE,
+		SCAN_MODE_BATCHED,
+	};
+
+	/**
+	 * Health statistics of one expander
+	 */
+	struct ExpanderStatus {
+		// IOCON read back and compared
+		uint32_t verifications;
+		// IOCON did not match (expander was reset, e.g. by brown-out) and was set up again
+		uint32_t resets;
+		// setup failed (expander is not scanned until next verification)
+		uint32_t failures;
+		// I2C errors (NAK) during scan
+		uint32_t errors;
+	};
+
+	/**
+	 * Measured time of synchronous scans (scanKeyboard/scanChanged) in us
+	 */
+	struct ScanTiming {
+		uint32_t last;
+		uint32_t max;
+		uint32_t total;
+		uint32_t count;
+	};
+
+private:
+	// transactions queued by queueScanGpio()
+	static const uint8_t QUEUED_TRANSACTIONS_PER_EXPANDER = 12;
+
+	// result of startScan(), written in ISR context
+	struct QueuedScan {
+		volatile uint8_t cols[8];
+		volatile uint8_t pos;
+		volatile uint8_t clear;
+		volatile uint8_t errors;
+		KeyboardMatrixController* owner;
+	};
+
+	struct GpioState {
+		bool ready;
+		// IOCON must be verified before the next scan
+		bool verify;
+		// rows held at the last scan (OR of its columns)
+		uint8_t rows;
+		ExpanderStatus status;
+		QueuedScan queued;
+	};
 
-class KeyboardMatrixController {
 	I2C& i2c;
-	MCP23017 gpio1;
-	MCP23017 gpio2;
-	bool gpio1_ready;
-	bool gpio2_ready;
+	MCP23017 gpio[EXPANDERS];
+	GpioState state[EXPANDERS];
+	ScanMode scanMode;
+
+	// startScan(): queue in use and next expander to be queued
+	I2CTransactionQueue* queue;
+	volatile uint8_t nextQueued;
+
+	// IOCON of each expander is verified once per this number of scans
+	// and after any I2C error
+	uint16_t verifyInterval;
+	uint16_t scansSinceVerify;
 
-	static const uint8_t GPIO1_SLAVE_ADDRESS = 0b0100000;
-	static const uint8_t GPIO2_SLAVE_ADDRESS = 0b0100100;
+	Timer timer;
+	ScanTiming timing;
+
+	static const uint16_t DEFAULT_VERIFY_INTERVAL = 250;
 
 	/**
 	 * COL=GPIOA (output normaly positive)
@@ -97,127 +175,417 @@ class KeyboardMatrixController {
 		return read == IOCON_VALUE;
 	}
 
-public:
-	KeyboardMatrixController(I2C& _i2c) :
-		i2c(_i2c),
-		gpio1(i2c, GPIO1_SLAVE_ADDRESS),
-		gpio2(i2c, GPIO2_SLAVE_ADDRESS)
-	{
-	}
-
-	void init() {
-		DEBUG_PRINTF("init gpio1\r\n");
-		gpio1_ready = setupGpio(gpio1);
-		DEBUG_PRINTF("gpio1 initialized: %s\r\n", gpio1_ready ? "success" : "failed");
+	void verifyGpio(MCP23017& gpio, GpioState& state) {
+		if (!state.verify) return;
+		state.verify = false;
 
-		DEBUG_PRINTF("init gpio2\r\n");
-		gpio2_ready = setupGpio(gpio2);
-		DEBUG_PRINTF("gpio2 initialized: %s\r\n", gpio2_ready ? "success" : "failed");
+		if (state.ready) {
+			state.status.verifications++;
+			if (checkGpio(gpio)) return;
+			DEBUG_PRINTF("checking gpio %02x failed. re-setup\r\n", gpio.slaveAddress());
+			state.status.resets++;
+		}
 
+		state.ready = setupGpio(gpio);
+		state.rows = 0;
+		if (!state.ready) {
+			state.status.failures++;
+		}
 	}
 
-	// __attribute__((used, long_call, section(".data")))
-	void scanKeyboard(uint8_t* keys) {
-		int ok;
+	void verifyGpios() {
+		const bool due = ++scansSinceVerify >= verifyInterval;
+		if (due) {
+			scansSinceVerify = 0;
+		}
 
-		disableInterrupt();
+		for (int n = 0; n < EXPANDERS; n++) {
+			if (due) state[n].verify = true;
+			verifyGpio(gpio[n], state[n]);
+		}
+	}
 
-		if (gpio1_ready) {
-			if (!checkGpio(gpio1)) {
-				DEBUG_PRINTF("checking gpio1 failed. re-setup");
-				gpio1_ready = setupGpio(gpio1);
-			}
+	/**
+	 * Called after every scan of an expander.
+	 * Any I2C error, or every column reading the same non-zero rows
+	 * (typical for an expander reset to its default IODIR/IPOL), triggers
+	 * verification before the next scan. A single bad scan never passes
+	 * the debounce filter.
+	 */
+	void checkScanResult(GpioState& state, const uint8_t* cols, const uint8_t errors) {
+		if (errors) {
+			state.status.errors += errors;
+			state.verify = true;
+			return;
 		}
 
-		if (gpio2_ready) {
-			if (!checkGpio(gpio2)) {
-				DEBUG_PRINTF("checking gpio2 failed. re-setup");
-				gpio2_ready = setupGpio(gpio2);
+		if (cols[0]) {
+			for (int i = 1; i < 8; i++) {
+				if (cols[i] != cols[0]) return;
 			}
+			state.verify = true;
+		}
+	}
+
+	/**
+	 * Scan 8 columns of each expander with targets[n] set.
+	 * keys[n*8 .. n*8+8) and rows of scanned expanders are updated.
+	 */
+	void scanGpios(uint8_t* keys, const bool (&targets)[EXPANDERS]) {
+		uint8_t errors[EXPANDERS] = { 0 };
+		uint8_t held[EXPANDERS] = { 0 };
+		int ok;
+
+		for (int n = 0; n < EXPANDERS; n++) {
+			if (!targets[n]) continue;
+			// Disable interrupt
+			ok = gpio[n].write8(
+				MCP23017::GPINTENB,
+				0b00000000
+			);
+			if (!ok) errors[n]++;
 		}
 
 		for (int i = 0; i < 8; i++) {
-			if (gpio1_ready) {
-				ok = gpio1.write8(
-					MCP23017::GPIOA,
-					~(1<<i)
-				);
-			}
-			if (gpio2_ready) {
-				ok = gpio2.write8(
-					MCP23017::GPIOA,
-					~(1<<i)
-				);
-			}
-			wait_us(1);
-			if (gpio1_ready) {
-				keys[i] = gpio1.read8(MCP23017::GPIOB, ok);
-			}
-			if (gpio2_ready) {
-				keys[i+8] = gpio2.read8(MCP23017::GPIOB, ok);
+			if (scanMode == SCAN_MODE_BATCHED) {
+				for (int n = 0; n < EXPANDERS; n++) {
+					if (!targets[n]) continue;
+					keys[n*8+i] = gpio[n].write8read8(
+						MCP23017::GPIOA,
+						~(1<<i),
+						ok
+					);
+					if (ok != 0) errors[n]++;
+					held[n] |= keys[n*8+i];
+				}
+			} else {
+				// drive all expanders first, so that reads of one expander
+				// are separated from its drive by the other's transactions
+				for (int n = 0; n < EXPANDERS; n++) {
+					if (!targets[n]) continue;
+					ok = gpio[n].write8(
+						MCP23017::GPIOA,
+						~(1<<i)
+					);
+					if (!ok) errors[n]++;
+				}
+				for (int n = 0; n < EXPANDERS; n++) {
+					if (!targets[n]) continue;
+					keys[n*8+i] = gpio[n].read8(MCP23017::GPIOB, ok);
+					if (ok != 0) errors[n]++;
+					held[n] |= keys[n*8+i];
+				}
 			}
 		}
 
-		// set all output to negative for interrupt
-		if (gpio1_ready) {
-			ok = gpio1.write8(
+		for (int n = 0; n < EXPANDERS; n++) {
+			if (!targets[n]) continue;
+
+			// set all output to negative for interrupt
+			ok = gpio[n].write8(
 				MCP23017::GPIOA,
 				0b00000000
 			);
-		}
-		if (gpio2_ready) {
-			ok = gpio2.write8(
-				MCP23017::GPIOA,
-				0b00000000
+			if (!ok) errors[n]++;
+
+			// Enable interrupt
+			ok = gpio[n].write8(
+				MCP23017::GPINTENB,
+				0b11111111
 			);
+			if (!ok) errors[n]++;
+
+			// Clear interrupt.
+			// A key changed while interrupt was disabled shows up here
+			// and keeps this expander on the scan path of scanChanged().
+			state[n].rows = held[n] | gpio[n].read8(MCP23017::GPIOB, ok);
+			if (ok != 0) errors[n]++;
+
+			checkScanResult(state[n], keys + n*8, errors[n]);
 		}
+	}
 
-		enableInterrupt();
+	void recordScanTime(const uint32_t start) {
+		const uint32_t elapsed = timer.read_us() - start;
+		timing.last = elapsed;
+		if (elapsed > timing.max) timing.max = elapsed;
+		timing.total += elapsed;
+		timing.count++;
 	}
 
-	int disableInterrupt() {
-		int ok;
-		if (gpio1_ready) {
-			// Disable interrupt
-			ok = gpio1.write8(
-				MCP23017::GPINTENB,
-				0b00000000
-			);
+	static void queuedColumn(void* context, const I2CTransaction& transaction) {
+		QueuedScan* queued = static_cast<QueuedScan*>(context);
+		if (transaction.status) queued->errors++;
+		queued->cols[queued->pos++] = transaction.status ? 0 : transaction.rx[0];
+	}
+
+	static void queuedClear(void* context, const I2CTransaction& transaction) {
+		QueuedScan* queued = static_cast<QueuedScan*>(context);
+		if (transaction.status) queued->errors++;
+		queued->clear = transaction.status ? 0 : transaction.rx[0];
+		// slots of this expander are free now
+		queued->owner->queueMore();
+	}
+
+	static void queuedWrite(void* context, const I2CTransaction& transaction) {
+		QueuedScan* queued = static_cast<QueuedScan*>(context);
+		if (transaction.status) queued->errors++;
+	}
+
+	/**
+	 * Same sequence as scanGpios() for one expander on the transaction queue.
+	 * The queue must have QUEUED_TRANSACTIONS_PER_EXPANDER free slots.
+	 */
+	void queueScanGpio(I2CTransactionQueue& queue, MCP23017& gpio, QueuedScan& queued) {
+		gpio.queueWrite8(queue, MCP23017::GPINTENB, 0b00000000, queuedWrite, &queued);
+		for (int i = 0; i < 8; i++) {
+			gpio.queueWrite8Read8(queue, MCP23017::GPIOA, ~(1<<i), queuedColumn, &queued);
 		}
+		gpio.queueWrite8(queue, MCP23017::GPIOA, 0b00000000, queuedWrite, &queued);
+		gpio.queueWrite8(queue, MCP23017::GPINTENB, 0b11111111, queuedWrite, &queued);
+		gpio.queueRead8(queue, MCP23017::GPIOB, queuedClear, &queued);
+	}
 
-		if (gpio2_ready) {
-			// Disable interrupt
-			ok = gpio2.write8(
-				MCP23017::GPINTENB,
-				0b00000000
-			);
+	/**
+	 * Queue remaining expanders as long as the queue has room.
+	 * Called from startScan() and from ISR when an expander finished.
+	 */
+	void queueMore() {
+		while (nextQueued < EXPANDERS) {
+			const uint8_t n = nextQueued;
+			if (state[n].ready) {
+				if (queue->available() < QUEUED_TRANSACTIONS_PER_EXPANDER) return;
+				queueScanGpio(*queue, gpio[n], state[n].queued);
+			}
+			nextQueued = n + 1;
 		}
-		return ok;
 	}
 
-	int enableInterrupt() {
+	void collectGpio(GpioState& state, uint8_t* cols) {
+		uint8_t held = 0;
+		for (int i = 0; i < 8; i++) {
+			cols[i] = state.queued.cols[i];
+			held |= cols[i];
+		}
+		state.rows = held | state.queued.clear;
+		checkScanResult(state, cols, state.queued.errors);
+	}
+
+	/**
+	 * Returns true when the expander must be scanned.
+	 * Otherwise its columns are filled with zero.
+	 */
+	bool checkChangedGpio(MCP23017& gpio, GpioState& state, uint8_t* cols) {
+		if (!state.ready) {
+			memset(cols, 0, 8);
+			return false;
+		}
+
 		int ok;
-		if (gpio1_ready) {
-			// Enable interrupt
-			ok = gpio1.write8(
-				MCP23017::GPINTENB,
-				0b11111111
-			);
+		const uint8_t flags = gpio.read8(MCP23017::INTFB, ok);
+		if (ok != 0) {
+			state.status.errors++;
+			state.verify = true;
 		}
-		
-		/*
-		// Clear interrupt
-		gpio1.read8(MCP23017::GPIOB, ok);
-		gpio2.read8(MCP23017::GPIOB, ok);
-		*/
-		if (gpio2_ready) {
-			// Enable interrupt
-			ok = gpio2.write8(
-				MCP23017::GPINTENB,
-				0b11111111
-			);
+		if (!flags && !state.rows) {
+			memset(cols, 0, 8);
+			return false;
+		}
+
+		if (flags) {
+			// rows at the moment of the interrupt (reading INTCAPB clears it)
+			const uint8_t captured = gpio.read8(MCP23017::INTCAPB, ok);
+			DEBUG_PRINTF_KEYEVENT("INTFB=%02x INTCAPB=%02x\r\n", flags, captured);
+			if (!captured && !state.rows) {
+				// changed back before we read it: nothing is held
+				memset(cols, 0, 8);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+public:
+	/**
+	 * addresses: 7-bit slave address of each expander
+	 */
+	KeyboardMatrixController(I2C& _i2c, const uint8_t (&addresses)[EXPANDERS]) :
+		i2c(_i2c),
+		scanMode(SCAN_MODE_BATCHED),
+		queue(NULL),
+		nextQueued(EXPANDERS),
+		verifyInterval(DEFAULT_VERIFY_INTERVAL),
+		scansSinceVerify(0)
+	{
+		for (int n = 0; n < EXPANDERS; n++) {
+			gpio[n].attach(i2c, addresses[n]);
+		}
+		memset(state, 0, sizeof(state));
+		memset(&timing, 0, sizeof(timing));
+	}
+
+	void setScanMode(const ScanMode mode) {
+		scanMode = mode;
+	}
+
+	/**
+	 * Verify IOCON of expanders once per `scans` scans.
+	 * 1 verifies on every scan (previous behavior).
+	 */
+	void setVerifyInterval(const uint16_t scans) {
+		verifyInterval = scans ? scans : 1;
+	}
+
+	/**
+	 * index: order of addresses given to the constructor
+	 */
+	const ExpanderStatus& expanderStatus(const int index) const {
+		return state[index].status;
+	}
+
+	bool expanderReady(const int index) const {
+		return state[index].ready;
+	}
+
+	/**
+	 * Total I2C bus transactions issued to all expanders.
+	 * Sample before and after scanKeyboard() to get the cost per scan.
+	 */
+	uint32_t transactionCount() const {
+		uint32_t count = 0;
+		for (int n = 0; n < EXPANDERS; n++) {
+			count += gpio[n].transactionCount();
+		}
+		return count;
+	}
+
+	virtual void init() {
+		timer.start();
+
+		for (int n = 0; n < EXPANDERS; n++) {
+			DEBUG_PRINTF("init gpio %02x\r\n", gpio[n].slaveAddress());
+			state[n].ready = setupGpio(gpio[n]);
+			DEBUG_PRINTF("gpio %02x initialized: %s\r\n", gpio[n].slaveAddress(), state[n].ready ? "success" : "failed");
+			if (!state[n].ready) state[n].status.failures++;
+		}
+	}
+
+	// __attribute__((used, long_call, section(".data")))
+	void scanKeyboard(uint8_t* keys) {
+		const uint32_t start = timer.read_us();
+		verifyGpios();
+
+		bool targets[EXPANDERS];
+		for (int n = 0; n < EXPANDERS; n++) {
+			targets[n] = state[n].ready;
+			if (!targets[n]) memset(keys + n*8, 0, 8);
+		}
+		scanGpios(keys, targets);
+		recordScanTime(start);
+	}
+
+	/**
+	 * Fast path of scanKeyboard().
+	 *
+	 * All columns are driven low while idle, so any key press or release of
+	 * the last key in a row raises the interrupt and sets INTFB.
+	 * An expander without INTFB flags and without held keys cannot have
+	 * changed, so its columns are filled with zero without scanning.
+	 */
+	void scanChanged(uint8_t* keys) {
+		const uint32_t start = timer.read_us();
+		verifyGpios();
+
+		bool targets[EXPANDERS];
+		for (int n = 0; n < EXPANDERS; n++) {
+			targets[n] = checkChangedGpio(gpio[n], state[n], keys + n*8);
 		}
+		scanGpios(keys, targets);
+		recordScanTime(start);
+	}
+
+	const ScanTiming& scanTiming() const {
+		return timing;
+	}
+
+	void resetScanTiming() {
+		memset(&timing, 0, sizeof(timing));
+	}
+
+	// KeyboardMatrix
+	virtual void scan(uint8_t* keys) {
+		// only expanders which raised interrupt or have held keys are scanned
+		scanChanged(keys);
+	}
+
+	virtual uint8_t cols() const {
+		return EXPANDERS * 8;
+	}
+
+	/**
+	 * Non-blocking scanKeyboard().
+	 * The whole scan is put on the queue and runs on the bus while the
+	 * caller processes the previous result. Get the result by collectScan()
+	 * after queue.idle() became true.
+	 */
+	void startScan(I2CTransactionQueue& _queue) {
+		// expander verification below uses blocking I2C
+		while (!_queue.idle());
+
+		verifyGpios();
 
+		for (int n = 0; n < EXPANDERS; n++) {
+			memset(&state[n].queued, 0, sizeof(QueuedScan));
+			state[n].queued.owner = this;
+		}
+
+		// expanders which do not fit in the queue are queued from ISR
+		__disable_irq();
+		queue = &_queue;
+		nextQueued = 0;
+		queueMore();
+		__enable_irq();
+	}
+
+	/**
+	 * true when the scan started by startScan() is finished
+	 */
+	bool scanCompleted() const {
+		return nextQueued >= EXPANDERS && queue->idle();
+	}
+
+	void collectScan(uint8_t* keys) {
+		for (int n = 0; n < EXPANDERS; n++) {
+			collectGpio(state[n], keys + n*8);
+		}
+	}
+
+	int disableInterrupt() {
+		int ok = 1;
+		for (int n = 0; n < EXPANDERS; n++) {
+			if (state[n].ready) {
+				// Disable interrupt
+				ok = gpio[n].write8(
+					MCP23017::GPINTENB,
+					0b00000000
+				);
+			}
+		}
+		return ok;
+	}
+
+	int enableInterrupt() {
+		int ok = 1;
+		for (int n = 0; n < EXPANDERS; n++) {
+			if (state[n].ready) {
+				// Enable interrupt
+				ok = gpio[n].write8(
+					MCP23017::GPINTENB,
+					0b11111111
+				);
+			}
+		}
 		return ok;
 	}
 };
@@ -0,0 +1,114 @@
+#ifndef __LAYER_STACK_H__
+#define __LAYER_STACK_H__
+
+#include <stdint.h>
+
+/**
+ * Active keymap layers as a bitmask (up to 32 layers).
+ *
+ *   default layer  always active, changed by setDefault() (DF)
+ *   momentary      on() while the key is held, off() on release (MO)
+ *   toggle         toggle() on press (TG)
+ *   one-shot       active for the next key press only (OSL).
+ *                  When other keys are pressed while it is held,
+ *                  it works as momentary.
+ *
+ * The highest active layer wins; Keymap falls through transparent keys.
+ */
+class LayerStack {
+	uint32_t layers;
+	uint8_t defaultLayer;
+
+	// one-shot layers: active, OSL key already released, used by a key press
+	uint32_t oneShot;
+	uint32_t oneShotReleased;
+	uint32_t oneShotUsed;
+
+	static uint32_t bit(const uint8_t layer) {
+		return 1UL << layer;
+	}
+
+	void clearOneShot(const uint32_t mask) {
+		layers &= ~mask;
+		oneShot &= ~mask;
+		oneShotReleased &= ~mask;
+		oneShotUsed &= ~mask;
+	}
+
+public:
+	static const uint8_t MAX_LAYERS = 32;
+
+	LayerStack() :
+		layers(0),
+		defaultLayer(0),
+		oneShot(0),
+		oneShotReleased(0),
+		oneShotUsed(0)
+	{
+	}
+
+	bool isActive(const uint8_t layer) const {
+		return layer == defaultLayer || (layers & bit(layer));
+	}
+
+	// bitmask of active layers including default layer
+	uint32_t state() const {
+		return layers | bit(defaultLayer);
+	}
+
+	uint8_t highest() const {
+		const uint32_t active = state();
+		uint8_t layer = MAX_LAYERS - 1;
+		while (!(active & bit(layer))) layer--;
+		return layer;
+	}
+
+	void on(const uint8_t layer) {
+		layers |= bit(layer);
+	}
+
+	void off(const uint8_t layer) {
+		clearOneShot(bit(layer));
+	}
+
+	void toggle(const uint8_t layer) {
+		if (layers & bit(layer)) {
+			off(layer);
+		} else {
+			on(layer);
+		}
+	}
+
+	void setDefault(const uint8_t layer) {
+		defaultLayer = layer;
+	}
+
+	void oneShotPress(const uint8_t layer) {
+		on(layer);
+		oneShot |= bit(layer);
+		oneShotReleased &= ~bit(layer);
+		oneShotUsed &= ~bit(layer);
+	}
+
+	void oneShotRelease(const uint8_t layer) {
+		if (!(oneShot & bit(layer))) return;
+		if (oneShotUsed & bit(layer)) {
+			// used while held: momentary
+			clearOneShot(bit(layer));
+		} else {
+			// wait for the next key
+			oneShotReleased |= bit(layer);
+		}
+	}
+
+	/**
+	 * Call after a non-layer key press was resolved.
+	 * Ends one-shot layers whose key is already released.
+	 */
+	void keyPressed() {
+		clearOneShot(oneShot & oneShotReleased);
+		oneShotUsed |= oneShot;
+	}
+};
+
+#endif
@@ -16,156 +16,628 @@
 * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
-#include "USBKeyboard.h"
+#include "USBHIDFunction.h"
+#include "CircBuffer.h"
 #include "keyboard.h"
 
-class MyUSBKeyboard: public USBHID {
-	union InputReportData {
-		HID_REPORT hid_report;
-		struct {
-			uint32_t length;
-			uint8_t report_id;
-			uint8_t modifier;
-			uint8_t padding;
-			uint8_t keycode[6];
-		} data;
+#if USB_POLLING_INTERVAL_MS < 1 || USB_POLLING_INTERVAL_MS > 255
+#error "USB_POLLING_INTERVAL_MS must be 1-255 (bInterval of full speed interrupt endpoint)"
+#endif
+
+#if REPORT_QUEUE_SIZE < 3
+#error "REPORT_QUEUE_SIZE must be >= 3 (2 reports may be in flight)"
+#endif
+
+/**
+ * Keyboard interface of a USBComposite device (boot keyboard, report
+ * protocol with NKRO / system / consumer control reports).
+ */
+class MyUSBKeyboard: public USBHIDFunction {
+	// NKRO bitmap covers usage 0x00-0xE7 (modifiers are 0xE0-0xE7)
+	static const uint8_t NKRO_USAGES = 0xE8;
+	static const uint8_t NKRO_BYTES = NKRO_USAGES / 8;
+
+	/**
+	 * Key state
+	 *   pressed  presence bitmap of all 256 usages. modifier byte and
+	 *            NKRO report are parts of this (usage 0xE0-0xE7 = byte 28)
+	 *   doubled  pressed twice (same key code on two keys)
+	 *   keycode  6KRO slots in press order, zero filled. Kept in sync with
+	 *            pressed on every event in both protocols, so switching to
+	 *            the boot protocol finds them valid
+	 */
+	uint8_t pressed[32];
+	uint8_t doubled[32];
+	uint8_t keycode[6];
+	uint8_t slotCount;
+	// some pressed keys do not fit in keycode[]
+	bool overflow;
+	volatile bool dirty;
+
+	/**
+	 * Consumer / system control state (report protocol only)
+	 *   consumer  Consumer page usages, in press order (0: empty)
+	 *   system    Generic Desktop system control usage (0: none)
+	 * Dirty until the report is in the queue, so a report which did not fit
+	 * is retried by the next queueCurrentReportData().
+	 */
+	static const uint8_t CONSUMER_KEYS = 2;
+	uint16_t consumer[CONSUMER_KEYS];
+	uint8_t system;
+	volatile bool consumerDirty;
+	volatile bool systemDirty;
+
+	enum ReportKind {
+		REPORT_KIND_KEYBOARD,
+		REPORT_KIND_CONSUMER,
+		REPORT_KIND_SYSTEM,
+		REPORT_KINDS
 	};
 
-	InputReportData inputReportData;
-	uint8_t lock_status;
+	// one report as sent on the interrupt IN endpoint (NKRO is the largest)
+	struct ReportSnapshot {
+		// word aligned for word copy to USB RAM (USBMemCopy)
+		uint8_t data[1 + NKRO_BYTES] __attribute__((aligned(4)));
+		uint8_t kind;
+		uint8_t length;
+		// USB frame of the scan which made this report (inputSampled())
+		uint16_t inputFrame;
+	};
 
-	static const uint8_t MODIFIER_LEFT_CONTROL = 1<<0;
-	static const uint8_t MODIFIER_LEFT_SHIFT = 1<<1;
-	static const uint8_t MODIFIER_LEFT_ALT = 1<<2;
-	static const uint8_t MODIFIER_LEFT_GUI = 1<<3;
-	static const uint8_t MODIFIER_RIGHT_CONTROL = 1<<4;
-	static const uint8_t MODIFIER_RIGHT_SHIFT = 1<<5;
-	static const uint8_t MODIFIER_RIGHT_ALT = 1<<6;
-	static const uint8_t MODIFIER_RIGHT_GUI = 1<<7;
+public:
+	struct ReportQueueStats {
+		uint32_t queued;
+		uint32_t sent;
+		// queue was full: folded into the newest snapshot (intermediate state lost)
+		uint32_t merged;
+		uint8_t maxDepth;
+	};
+
+	static const uint8_t LATENCY_BUCKETS = 16;
+	/**
+	 * Frames from inputSampled() to the host taking the report (interrupt IN
+	 * complete). counts[n]: n frames, last bucket: LATENCY_BUCKETS-1 or more.
+	 */
+	struct LatencyHistogram {
+		uint32_t counts[LATENCY_BUCKETS];
+	};
+
+private:
+	// latest keyboard report built from key state
+	ReportSnapshot inputReport;
+	// last report of each kind pushed to reports
+	ReportSnapshot queuedReports[REPORT_KINDS];
+	// snapshots in event order. first inFlight are on the IN endpoint,
+	// removed by reportSent() when the host took it
+	CircBuffer<ReportSnapshot, REPORT_QUEUE_SIZE> reports;
+	// IN endpoint is double buffered: the next report is staged while one is sent
+	static const uint8_t MAX_IN_FLIGHT = 2;
+	// reports at head of reports handed to the IN endpoint, not acknowledged yet
+	volatile uint8_t inFlight;
+	// kinds whose change did not fit in reports, in order (pushPending())
+	uint8_t pendingKinds[REPORT_KINDS];
+	uint8_t pendingCount;
+	ReportQueueStats stats;
+	uint8_t lock_status;
+	// HID_BOOT_PROTOCOL / HID_REPORT_PROTOCOL (SET_PROTOCOL)
+	uint8_t protocol;
+	// called on every SOF (1ms, ISR context)
+	void (*sofHandler)(int frameNumber);
+	// USB frame number (11bit) of the last SOF and its time (us_ticker)
+	volatile uint16_t frame;
+	volatile uint32_t frameStart;
+	uint16_t inputFrame;
+	// us from SOF to IN endpoint complete (host IN token), -1: not seen yet
+	volatile int16_t inPhase;
+	LatencyHistogram latency;
 
 	static const uint8_t REPORT_ID_KEYBOARD = 1;
-	static const uint8_t REPORT_ID_VOLUME = 3;
+	static const uint8_t REPORT_ID_SYSTEM = 2;
+	static const uint8_t REPORT_ID_CONSUMER = 3;
+	static const uint8_t REPORT_ID_NKRO = 4;
+
+	/**
+	 * boot protocol: modifier, reserved, keycode[6] (no report ID)
+	 * report protocol: REPORT_ID_NKRO, bitmap (NKRO_ENABLE)
+	 *                  REPORT_ID_KEYBOARD, modifier, reserved, keycode[6]
+	 */
+	void buildReport() {
+		inputReport.kind = REPORT_KIND_KEYBOARD;
+		uint8_t* data = inputReport.data;
+		if (protocol == HID_REPORT_PROTOCOL) {
+#if NKRO_ENABLE
+			*data++ = REPORT_ID_NKRO;
+			memcpy(data, pressed, NKRO_BYTES);
+			inputReport.length = 1 + NKRO_BYTES;
+			return;
+#else
+			*data++ = REPORT_ID_KEYBOARD;
+#endif
+		}
+		*data++ = pressed[KEY_LeftControl >> 3];
+		*data++ = 0;
+		memcpy(data, keycode, sizeof(keycode));
+		inputReport.length = (data - inputReport.data) + sizeof(keycode);
+	}
 
+	// REPORT_ID_CONSUMER, usage[CONSUMER_KEYS] (16bit LE)
+	void buildConsumerReport(ReportSnapshot& report) const {
+		report.kind = REPORT_KIND_CONSUMER;
+		report.data[0] = REPORT_ID_CONSUMER;
+		for (uint8_t i = 0; i < CONSUMER_KEYS; i++) {
+			report.data[1 + i * 2] = LSB(consumer[i]);
+			report.data[2 + i * 2] = MSB(consumer[i]);
+		}
+		report.length = 1 + CONSUMER_KEYS * 2;
+	}
 
-public:
-	MyUSBKeyboard(uint16_t vendor_id = 0x1235, uint16_t product_id = 0x0050, uint16_t product_release = 0x0001):
-		USBHID(0, 0, vendor_id, product_id, product_release, false),
-		lock_status(0)
-	{
-		connect();
-		memset(&inputReportData, 0, sizeof(inputReportData));
-	};
+	// REPORT_ID_SYSTEM, usage
+	void buildSystemReport(ReportSnapshot& report) const {
+		report.kind = REPORT_KIND_SYSTEM;
+		report.data[0] = REPORT_ID_SYSTEM;
+		report.data[1] = system;
+		report.length = 2;
+	}
 
-	void appendReportData(const uint8_t keycode) {
-		uint8_t modifier = toModifierBit(keycode);
-		if (modifier) {
-			inputReportData.data.modifier |= modifier;
-			return;
+	static bool sameReport(const ReportSnapshot& a, const ReportSnapshot& b) {
+		return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+	}
+
+	/**
+	 * IRQ disabled. Append report unless it equals the last one of its kind.
+	 * When full, only the newest queued report may be replaced, if it is of
+	 * the same kind and not in flight; replacing an older one would move the
+	 * change before the reports queued after it. Otherwise returns false and
+	 * pushPending() tries again when the host took a report.
+	 */
+	bool push(const ReportSnapshot& report) {
+		ReportSnapshot& queued = queuedReports[report.kind];
+		if (sameReport(report, queued)) return true;
+
+		ReportSnapshot* slot = reports.reserve();
+		if (slot) {
+			*slot = report;
+			reports.commit();
+			stats.queued++;
+			const uint8_t depth = reports.available();
+			if (depth > stats.maxDepth) stats.maxDepth = depth;
+		} else {
+			if (reports.available() <= inFlight) return false;
+			slot = reports.last();
+			if (slot->kind != report.kind) return false;
+			*slot = report;
+			stats.merged++;
+		}
+		queued = report;
+		return true;
+	}
+
+	// state of kind differs from the last queued report
+	bool changed(const uint8_t kind) const {
+		switch (kind) {
+			case REPORT_KIND_KEYBOARD:
+				return !sameReport(inputReport, queuedReports[REPORT_KIND_KEYBOARD]);
+			case REPORT_KIND_CONSUMER:
+				return consumerDirty;
+			case REPORT_KIND_SYSTEM:
+				return systemDirty;
+		}
+		return false;
+	}
+
+	bool pushKind(const uint8_t kind) {
+		if (kind == REPORT_KIND_KEYBOARD) return push(inputReport);
+
+		ReportSnapshot report;
+		report.inputFrame = inputFrame;
+		if (kind == REPORT_KIND_CONSUMER) {
+			buildConsumerReport(report);
+			if (!push(report)) return false;
+			consumerDirty = false;
+		} else {
+			buildSystemReport(report);
+			if (!push(report)) return false;
+			systemDirty = false;
 		}
+		return true;
+	}
 
+	/**
+	 * IRQ disabled or ISR context. Push state which is not queued yet:
+	 * inputReport (built by queueCurrentReportData()) and dirty consumer /
+	 * system control state. Kinds which did not fit are kept in
+	 * pendingKinds and go first next time, so no change overtakes them.
+	 */
+	void pushPending() {
+		// boot protocol host knows only the keyboard report
+		const uint8_t kinds = protocol == HID_REPORT_PROTOCOL ? REPORT_KINDS : 1;
+
+		while (pendingCount) {
+			const uint8_t kind = pendingKinds[0];
+			if (kind < kinds && changed(kind) && !pushKind(kind)) return;
+			pendingCount--;
+			memmove(pendingKinds, pendingKinds + 1, pendingCount);
+		}
 
-		for (int i = 0; i < 6; i++) {
-			if (inputReportData.data.keycode[i] == 0) {
-				inputReportData.data.keycode[i] = keycode;
-				return;
+		for (uint8_t kind = 0; kind < kinds; kind++) {
+			if (!changed(kind)) continue;
+			if (pendingCount || !pushKind(kind)) {
+				pendingKinds[pendingCount++] = kind;
 			}
 		}
+	}
 
-		// report data is full. delete first key and add new key to last
-		for (int i = 0; i < 5; i++) {
-			inputReportData.data.keycode[i] = inputReportData.data.keycode[i+1];
+	// IRQ disabled or ISR context. Hands queued reports to IN endpoint buffers
+	bool startTransfer() {
+		while (inFlight < MAX_IN_FLIGHT) {
+			const ReportSnapshot* next = reports.at(inFlight);
+			if (!next) break;
+			if (!device->writeAsync(endpointIn(0), const_cast<uint8_t*>(next->data), next->length, MAX_HID_REPORT_SIZE)) {
+				// no free buffer: stays queued, retried on completion or next queueCurrentReportData()
+				return inFlight > 0;
+			}
+			inFlight++;
 		}
-		inputReportData.data.keycode[5] = keycode;
+		return true;
 	}
 
-	void deleteReportData(const uint8_t keycode) {
-		uint8_t modifier = toModifierBit(keycode);
-		if (modifier) {
-			inputReportData.data.modifier &= ~modifier;
+	// IRQ disabled or ISR context. Drops reports not handed to the IN
+	// endpoint yet; the current state of every kind is pushed again
+	void dropQueued() {
+		while (reports.available() > inFlight) reports.dropLast();
+		for (uint8_t kind = 0; kind < REPORT_KINDS; kind++) {
+			queuedReports[kind].length = 0;
+		}
+		pendingCount = 0;
+		consumerDirty = true;
+		systemDirty = true;
+	}
+
+	void resetTransfer() {
+		inFlight = 0;
+		dropQueued();
+	}
+
+	static bool isModifier(const uint8_t keycode) {
+		return keycode >= KEY_LeftControl && keycode <= KEY_RightGUI;
+	}
+
+	bool isPressed(const uint8_t keycode) const {
+		return pressed[keycode >> 3] & (1<<(keycode & 7));
+	}
+
+	bool inSlots(const uint8_t code) const {
+		for (uint8_t i = 0; i < slotCount; i++) {
+			if (keycode[i] == code) return true;
+		}
+		return false;
+	}
+
+	// pressed keys evicted by overflow get free slots back
+	void refillSlots() {
+		overflow = false;
+		for (int code = 1; code < KEY_LeftControl; code++) {
+			if (!isPressed(code) || inSlots(code)) continue;
+			if (slotCount == sizeof(keycode)) {
+				overflow = true;
+				break;
+			}
+			keycode[slotCount++] = code;
+		}
+	}
+
+	void removeSlot(const uint8_t code) {
+		for (uint8_t i = 0; i < slotCount; i++) {
+			if (keycode[i] != code) continue;
+			memmove(keycode + i, keycode + i + 1, slotCount - 1 - i);
+			keycode[--slotCount] = 0;
+			if (overflow) refillSlots();
 			return;
 		}
+	}
+
+public:
+	MyUSBKeyboard():
+		USBHIDFunction(HID_SUBCLASS_BOOT, HID_PROTOCOL_KEYBOARD, USB_POLLING_INTERVAL_MS),
+		slotCount(0),
+		overflow(false),
+		dirty(true),
+		system(0),
+		consumerDirty(false),
+		systemDirty(false),
+		lock_status(0),
+		protocol(HID_REPORT_PROTOCOL),
+		sofHandler(NULL),
+		frame(0),
+		frameStart(0),
+		inputFrame(0),
+		inPhase(-1)
+	{
+		memset(pressed, 0, sizeof(pressed));
+		memset(doubled, 0, sizeof(doubled));
+		memset(keycode, 0, sizeof(keycode));
+		memset(&inputReport, 0, sizeof(inputReport));
+		memset(consumer, 0, sizeof(consumer));
+		memset(queuedReports, 0, sizeof(queuedReports));
+		memset(&stats, 0, sizeof(stats));
+		memset(&latency, 0, sizeof(latency));
+		inFlight = 0;
+		pendingCount = 0;
+	};
+
+	void appendReportData(const uint8_t code) {
+		const uint8_t index = code >> 3;
+		const uint8_t mask = 1<<(code & 7);
+		if (pressed[index] & mask) {
+			doubled[index] |= mask;
+			return;
+		}
+		pressed[index] |= mask;
+		dirty = true;
 
-		uint8_t pressedKeyCount = 0;
-		for (int i = 0; i < 6; i++) {
-			if (inputReportData.data.keycode[i]) pressedKeyCount++;
+		if (isModifier(code)) return;
+
+		if (slotCount == sizeof(keycode)) {
+			// report data is full. delete first key and add new key to last
+			// (the first key is still in pressed[], refilled when a slot is freed)
+			memmove(keycode, keycode + 1, sizeof(keycode) - 1);
+			slotCount--;
+			overflow = true;
+		}
+		keycode[slotCount++] = code;
+	}
+
+	void deleteReportData(const uint8_t code) {
+		const uint8_t index = code >> 3;
+		const uint8_t mask = 1<<(code & 7);
+		if (!(pressed[index] & mask)) return;
+		if (doubled[index] & mask) {
+			doubled[index] &= ~mask;
+			return;
 		}
+		pressed[index] &= ~mask;
+		dirty = true;
+
+		if (!isModifier(code)) removeSlot(code);
+	}
 
-		for (int i = 0; i < 6; i++) {
-			if (inputReportData.data.keycode[i] == keycode) {
-				// remove specified key code
-				inputReportData.data.keycode[i] = 0;
-				pressedKeyCount--;
-				// move over another key codes
-				for (int j = 0; j < 5-i; j++) {
-					inputReportData.data.keycode[i+j] = inputReportData.data.keycode[i+j+1];
-				}
-				// fill zero to ends
-				for (int j = pressedKeyCount; j < 6; j++) {
-					inputReportData.data.keycode[j] = 0;
-				}
-				return;
+	/**
+	 * Consumer page (0x0C) usage, e.g. CONSUMER_PLAY_PAUSE.
+	 * Up to CONSUMER_KEYS at once, later ones are ignored.
+	 */
+	void appendConsumerData(const uint16_t usage) {
+		const uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		for (uint8_t i = 0; i < CONSUMER_KEYS; i++) {
+			if (consumer[i] == usage) break;
+			if (!consumer[i]) {
+				consumer[i] = usage;
+				consumerDirty = true;
+				break;
 			}
 		}
+		__set_PRIMASK(primask);
+	}
+
+	void deleteConsumerData(const uint16_t usage) {
+		const uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		for (uint8_t i = 0; i < CONSUMER_KEYS; i++) {
+			if (consumer[i] != usage) continue;
+			memmove(consumer + i, consumer + i + 1, (CONSUMER_KEYS - 1 - i) * sizeof(consumer[0]));
+			consumer[CONSUMER_KEYS - 1] = 0;
+			consumerDirty = true;
+			break;
+		}
+		__set_PRIMASK(primask);
 	}
 
+	/**
+	 * Generic Desktop system control usage: SYSTEM_POWER_DOWN, SYSTEM_SLEEP, SYSTEM_WAKE_UP
+	 */
+	void appendSystemData(const uint8_t usage) {
+		system = usage;
+		systemDirty = true;
+	}
+
+	void deleteSystemData(const uint8_t usage) {
+		if (system != usage) return;
+		system = 0;
+		systemDirty = true;
+	}
+
+	/**
+	 * Queue current key state as a report without blocking.
+	 *
+	 * Call after each key event: every change becomes its own report, sent
+	 * one per IN endpoint completion, so press order of fast rolls is kept even
+	 * when several keys change in one scan or while a report is in flight.
+	 * Same report as the last queued one is not queued.
+	 * Consumer / system control reports share the queue in the same order.
+	 */
 	bool queueCurrentReportData() {
-		inputReportData.data.report_id = REPORT_ID_KEYBOARD;
-		inputReportData.data.length = 9;
-		DEBUG_PRINTF_KEYEVENT("send %d bytes %02x %02x %02x %02x %02x %02x %02x %02x\r\n",
-			inputReportData.hid_report.length,
-			inputReportData.hid_report.data[0],
-			inputReportData.hid_report.data[1],
-			inputReportData.hid_report.data[2],
-			inputReportData.hid_report.data[3],
-			inputReportData.hid_report.data[4],
-			inputReportData.hid_report.data[5],
-			inputReportData.hid_report.data[6],
-			inputReportData.hid_report.data[7],
-			inputReportData.hid_report.data[8]
-		);
-		return send(&inputReportData.hid_report);
-	}
-
-	uint8_t toModifierBit(const uint8_t keycode) const {
-		switch (keycode) {
-			case KEY_LeftControl:  return MODIFIER_LEFT_CONTROL;
-			case KEY_LeftShift:    return MODIFIER_LEFT_SHIFT;
-			case KEY_LeftAlt:      return MODIFIER_LEFT_ALT;
-			case KEY_LeftGUI:      return MODIFIER_LEFT_GUI;
-			case KEY_RightControl: return MODIFIER_RIGHT_CONTROL;
-			case KEY_RightShift:   return MODIFIER_RIGHT_SHIFT;
-			case KEY_RightAlt:     return MODIFIER_RIGHT_ALT;
-			case KEY_RightGUI:     return MODIFIER_RIGHT_GUI;
+		if (!configured()) return false;
+
+		const uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+
+		if (dirty) {
+			dirty = false;
+			buildReport();
+		}
+		inputReport.inputFrame = inputFrame;
+
+		const bool queued = !sameReport(inputReport, queuedReports[REPORT_KIND_KEYBOARD]);
+		// no room: stays in inputReport / dirty flags until a report was sent
+		pushPending();
+
+		const bool ok = startTransfer();
+
+		__set_PRIMASK(primask);
+
+		if (queued) {
+			DEBUG_PRINTF_KEYEVENT("queue %d bytes %02x %02x %02x %02x %02x %02x %02x %02x %02x\r\n",
+				inputReport.length,
+				inputReport.data[0],
+				inputReport.data[1],
+				inputReport.data[2],
+				inputReport.data[3],
+				inputReport.data[4],
+				inputReport.data[5],
+				inputReport.data[6],
+				inputReport.data[7],
+				inputReport.data[8]
+			);
 		}
-		return 0;
+		return ok;
 	}
 
-	bool isKeyPressed() {
-		if (inputReportData.data.modifier != 0) {
-			return true;
+	// Called in ISR context
+	virtual bool endpointCallback(uint8_t endpoint) {
+		if (endpoint == endpointIn(0)) return reportSent();
+		if (endpoint == endpointOut(0)) return outputReportReceived();
+		return false;
+	}
+
+	// Called in ISR context when the host took the report
+	bool reportSent() {
+		if (inFlight) {
+			inFlight--;
+			const uint16_t frames = (frame - reports.peek()->inputFrame) & 0x7FF;
+			latency.counts[frames < LATENCY_BUCKETS ? frames : LATENCY_BUCKETS - 1]++;
+			inPhase = (us_ticker_read() - frameStart) % 1000;
+			reports.drop();
+			stats.sent++;
+			pushPending();
 		}
+		startTransfer();
+		return true;
+	}
+
+	/**
+	 * Called from USB interrupt on each start of frame (every 1ms while the
+	 * bus is not suspended). frameNumber is 11bit.
+	 */
+	void attachSOF(void (*handler)(int frameNumber)) {
+		sofHandler = handler;
+	}
 
-		for (int i = 0; i < 5; i++) {
-			if (inputReportData.data.keycode[i]) {
-				return 1;
+	// USBFunction (routed from USBHAL)
+	virtual void SOF(int frameNumber) {
+		frameStart = us_ticker_read();
+		frame = frameNumber;
+		if (sofHandler) sofHandler(frameNumber);
+	}
+
+	/**
+	 * Call when the matrix is read. Reports queued until the next call are
+	 * counted in latencyHistogram() from this frame.
+	 */
+	void inputSampled() {
+		inputFrame = frame;
+	}
+
+	// same as inputSampled() for a matrix read started in an earlier frame
+	void inputSampled(const uint16_t sampledFrame) {
+		inputFrame = sampledFrame;
+	}
+
+	// USB frame number (11bit) of the last SOF
+	uint16_t frameNumber() const {
+		return frame;
+	}
+
+	/**
+	 * us from SOF to the host IN token of the IN endpoint, measured on the last
+	 * report sent. -1 until a report was sent.
+	 */
+	int16_t inTokenPhase() const {
+		return inPhase;
+	}
+
+	const LatencyHistogram& latencyHistogram() const {
+		return latency;
+	}
+
+	void resetLatencyHistogram() {
+		memset(&latency, 0, sizeof(latency));
+	}
+
+	const ReportQueueStats& reportQueueStats() const {
+		return stats;
+	}
+
+	uint8_t currentProtocol() const {
+		return protocol;
+	}
+
+	bool isKeyPressed() {
+		for (int i = 0; i < 32; i++) {
+			if (pressed[i]) {
+				return true;
 			}
 		}
-		return 0;
+		return false;
 	}
 
-	virtual bool EPINT_OUT_callback() {
+	// LED output report on the interrupt OUT endpoint
+	bool outputReportReceived() {
 		uint32_t bytesRead = 0;
 		uint8_t led[MAX_HID_REPORT_SIZE+1];
-		USBDevice::readEP(EPINT_OUT, led, &bytesRead, MAX_HID_REPORT_SIZE);
+		device->readEP(endpointOut(0), led, &bytesRead, MAX_HID_REPORT_SIZE);
 
-		// we take led[1] because led[0] is the report ID
-		lock_status = led[1] & 0x07;
+		// we take led[1] because led[0] is the report ID (no report ID in boot protocol)
+		lock_status = led[protocol == HID_BOOT_PROTOCOL ? 0 : 1] & 0x07;
 
 		// We activate the endpoint to be able to recceive data
-		if (!readStart(EPINT_OUT, MAX_HID_REPORT_SIZE)) return false;
+		if (!device->readStart(endpointOut(0), MAX_HID_REPORT_SIZE)) return false;
 		return true;
 	}
 
+	// LED output report by SET_REPORT (hosts without interrupt OUT)
+	virtual void HID_callbackSetReport(HID_REPORT *report) {
+		// data[0] is wValue report ID, the data stage repeats it in report protocol
+		const uint8_t index = protocol == HID_BOOT_PROTOCOL ? 1 : 2;
+		if (report->length <= index) return;
+		lock_status = report->data[index] & 0x07;
+	}
+
+	// Called in ISR context
+	virtual bool request(CONTROL_TRANSFER* transfer) {
+		if (transfer->setup.bmRequestType.Type == CLASS_TYPE) {
+			switch (transfer->setup.bRequest) {
+				case SET_PROTOCOL:
+					// BIOS selects boot protocol, OS keeps report protocol
+					if ((transfer->setup.wValue & 0xff) != protocol) {
+						protocol = transfer->setup.wValue & 0xff;
+						// queued reports are in the old format. The ones on
+						// the IN endpoint cannot be taken back
+						dropQueued();
+					}
+					dirty = true;
+					consumerDirty = true;
+					systemDirty = true;
+					transfer->remaining = 0;
+					return true;
+				case GET_PROTOCOL:
+					transfer->remaining = 1;
+					transfer->ptr = &protocol;
+					transfer->direction = DEVICE_TO_HOST;
+					return true;
+			}
+		}
+		return USBHIDFunction::request(transfer);
+	}
+
+	// Called in ISR context
+	virtual bool setConfiguration() {
+		// report protocol is default after (re)configuration
+		protocol = HID_REPORT_PROTOCOL;
+		dirty = true;
+		resetTransfer();
+		return USBHIDFunction::setConfiguration();
+	}
+
 
 	virtual uint8_t* reportDesc() {
 		static uint8_t reportDescriptor[] = {
@@ -208,85 +680,50 @@ public:
 			INPUT(1), 0x00,                         // Data, Array
 			END_COLLECTION(0),
 
-			// Media Control
-			USAGE_PAGE(1), 0x0C,
-			USAGE(1), 0x01,
-			COLLECTION(1), 0x01,
-			REPORT_ID(1), REPORT_ID_VOLUME,
-			USAGE_PAGE(1), 0x0C,
+			// N-key rollover: 1 bit per usage 0x00-0xE7 (includes modifiers)
+			USAGE_PAGE(1), 0x01,                    // Generic Desktop
+			USAGE(1), 0x06,                         // Keyboard
+			COLLECTION(1), 0x01,                    // Application
+			REPORT_ID(1),       REPORT_ID_NKRO,
+			USAGE_PAGE(1), 0x07,                    // Key Codes
+			USAGE_MINIMUM(1), 0x00,
+			USAGE_MAXIMUM(1), NKRO_USAGES - 1,
 			LOGICAL_MINIMUM(1), 0x00,
 			LOGICAL_MAXIMUM(1), 0x01,
 			REPORT_SIZE(1), 0x01,
-			REPORT_COUNT(1), 0x07,
-			USAGE(1), 0xB5,             // Next Track
-			USAGE(1), 0xB6,             // Previous Track
-			USAGE(1), 0xB7,             // Stop
-			USAGE(1), 0xCD,             // Play / Pause
-			USAGE(1), 0xE2,             // Mute
-			USAGE(1), 0xE9,             // Volume Up
-			USAGE(1), 0xEA,             // Volume Down
-			INPUT(1), 0x02,             // Input (Data, Variable, Absolute)
+			REPORT_COUNT(1), NKRO_USAGES,
+			INPUT(1), 0x02,                         // Data, Variable, Absolute
+			END_COLLECTION(0),
+
+			// System Control: one usage (0x81 Power Down, 0x82 Sleep, 0x83 Wake Up)
+			USAGE_PAGE(1), 0x01,                    // Generic Desktop
+			USAGE(1), 0x80,                         // System Control
+			COLLECTION(1), 0x01,                    // Application
+			REPORT_ID(1),       REPORT_ID_SYSTEM,
+			LOGICAL_MINIMUM(1), 0x00,
+			LOGICAL_MAXIMUM(2), 0xB7, 0x00,
+			USAGE_MINIMUM(1), 0x00,
+			USAGE_MAXIMUM(1), 0xB7,
+			REPORT_SIZE(1), 0x08,
 			REPORT_COUNT(1), 0x01,
-			INPUT(1), 0x01,
+			INPUT(1), 0x00,                         // Data, Array
+			END_COLLECTION(0),
+
+			// Consumer Control: CONSUMER_KEYS usages at once
+			USAGE_PAGE(1), 0x0C,                    // Consumer
+			USAGE(1), 0x01,                         // Consumer Control
+			COLLECTION(1), 0x01,                    // Application
+			REPORT_ID(1),       REPORT_ID_CONSUMER,
+			LOGICAL_MINIMUM(1), 0x00,
+			LOGICAL_MAXIMUM(2), 0xFF, 0x03,
+			USAGE_MINIMUM(1), 0x00,
+			USAGE_MAXIMUM(2), 0xFF, 0x03,
+			REPORT_SIZE(1), 0x10,
+			REPORT_COUNT(1), CONSUMER_KEYS,
+			INPUT(1), 0x00,                         // Data, Array
 			END_COLLECTION(0),
 		};
 		reportLength = sizeof(reportDescriptor);
 		return reportDescriptor;
 	}
-protected:
-	virtual uint8_t * configurationDesc() {
-#define DEFAULT_CONFIGURATION (1)
-#define TOTAL_DESCRIPTOR_LENGTH ((1 * CONFIGURATION_DESCRIPTOR_LENGTH) \
-                               + (1 * INTERFACE_DESCRIPTOR_LENGTH) \
-                               + (1 * HID_DESCRIPTOR_LENGTH) \
-                               + (2 * ENDPOINT_DESCRIPTOR_LENGTH))
-		static uint8_t configurationDescriptor[] = {
-			CONFIGURATION_DESCRIPTOR_LENGTH,    // bLength
-			CONFIGURATION_DESCRIPTOR,           // bDescriptorType
-			LSB(TOTAL_DESCRIPTOR_LENGTH),       // wTotalLength (LSB)
-			MSB(TOTAL_DESCRIPTOR_LENGTH),       // wTotalLength (MSB)
-			0x01,                               // bNumInterfaces
-			DEFAULT_CONFIGURATION,              // bConfigurationValue
-			0x00,                               // iConfiguration
-			C_RESERVED | C_SELF_POWERED,        // bmAttributes
-			C_POWER(0),                         // bMaxPower
-
-			INTERFACE_DESCRIPTOR_LENGTH,        // bLength
-			INTERFACE_DESCRIPTOR,               // bDescriptorType
-			0x00,                               // bInterfaceNumber
-			0x00,                               // bAlternateSetting
-			0x02,                               // bNumEndpoints
-			HID_CLASS,                          // bInterfaceClass
-			HID_SUBCLASS_BOOT,                  // bInterfaceSubClass
-			HID_PROTOCOL_KEYBOARD,              // bInterfaceProtocol
-			0x00,                               // iInterface
-
-			HID_DESCRIPTOR_LENGTH,              // bLength
-			HID_DESCRIPTOR,                     // bDescriptorType
-			LSB(HID_VERSION_1_11),              // bcdHID (LSB)
-			MSB(HID_VERSION_1_11),              // bcdHID (MSB)
-			0x00,                               // bCountryCode
-			0x01,                               // bNumDescriptors
-			REPORT_DESCRIPTOR,                  // bDescriptorType
-			(uint8_t)(LSB(reportDescLength())), // wDescriptorLength (LSB)
-			(uint8_t)(MSB(reportDescLength())), // wDescriptorLength (MSB)
-
-			ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
-			ENDPOINT_DESCRIPTOR,                // bDescriptorType
-			PHY_TO_DESC(EPINT_IN),              // bEndpointAddress
-			E_INTERRUPT,                        // bmAttributes
-			LSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (LSB)
-			MSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (MSB)
-			1,                                  // bInterval (milliseconds)
-
-			ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
-			ENDPOINT_DESCRIPTOR,                // bDescriptorType
-			PHY_TO_DESC(EPINT_OUT),             // bEndpointAddress
-			E_INTERRUPT,                        // bmAttributes
-			LSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (LSB)
-			MSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (MSB)
-			1,                                  // bInterval (milliseconds)
-		};
-		return configurationDescriptor;
-	}
 };
@@ -0,0 +1,89 @@
+#ifndef __PACKED_KEY_STATE_H__
+#define __PACKED_KEY_STATE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Key state packed row by row into 32-bit words.
+ *
+ *   bit index = row * COLS + col
+ *
+ * 8 rows x 16 cols is 4 words (2 rows per word), so the debounce filter and
+ * change detection run on 4 words instead of 16 column bytes, and changed keys
+ * are picked by count trailing zeros instead of testing every bit.
+ *
+ * Matrix backends keep returning one byte per column; pack() transposes
+ * each 8 column block (COLS must be multiple of 8).
+ */
+template <uint8_t ROWS, uint8_t COLS>
+struct PackedKeyState {
+	static const uint8_t COLUMNS = COLS;
+	static const uint16_t BITS = ROWS * COLS;
+	static const uint8_t WORDS = (BITS + 31) / 32;
+
+	uint32_t words[WORDS];
+
+	/**
+	 * Cortex-M0 has neither CLZ nor RBIT: isolate lowest bit and
+	 * look it up with de Bruijn sequence. x must not be 0.
+	 */
+	static uint8_t countTrailingZeros(const uint32_t x) {
+		static const uint8_t TABLE[32] = {
+			0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+			31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+		};
+		return TABLE[((x & -x) * 0x077CB531U) >> 27];
+	}
+
+	/**
+	 * 8x8 bit matrix transpose (Hacker's Delight 7-3).
+	 * in[col] bit row -> out[row] bit col
+	 */
+	static void transpose8(const uint8_t* in, uint8_t* out) {
+		// column 7 first so that column N lands on bit N
+		uint32_t x = (static_cast<uint32_t>(in[7]) << 24) | (in[6] << 16) | (in[5] << 8) | in[4];
+		uint32_t y = (static_cast<uint32_t>(in[3]) << 24) | (in[2] << 16) | (in[1] << 8) | in[0];
+		uint32_t t;
+
+		t = (x ^ (x >> 7)) & 0x00AA00AA; x = x ^ t ^ (t << 7);
+		t = (y ^ (y >> 7)) & 0x00AA00AA; y = y ^ t ^ (t << 7);
+
+		t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+		t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+
+		t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+		y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+		x = t;
+
+		// byte 0 (MSB) of x holds bit 7 of every input: row 7
+		out[7] = x >> 24; out[6] = x >> 16; out[5] = x >> 8; out[4] = x;
+		out[3] = y >> 24; out[2] = y >> 16; out[1] = y >> 8; out[0] = y;
+	}
+
+	void clear() {
+		memset(words, 0, sizeof(words));
+	}
+
+	/**
+	 * cols: one byte per column, bit N is row N (KeyboardMatrix format)
+	 */
+	void pack(const uint8_t* cols) {
+		clear();
+		for (uint8_t block = 0; block < COLS / 8; block++) {
+			uint8_t rows[8];
+			transpose8(cols + block * 8, rows);
+			for (uint8_t row = 0; row < ROWS; row++) {
+				const uint16_t bit = row * COLS + block * 8;
+				words[bit >> 5] |= static_cast<uint32_t>(rows[row]) << (bit & 31);
+			}
+		}
+	}
+
+	bool isPressed(const uint8_t row, const uint8_t col) const {
+		const uint16_t bit = row * COLS + col;
+		return words[bit >> 5] & (1UL << (bit & 31));
+	}
+};
+
+#endif
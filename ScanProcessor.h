@@ -0,0 +1,88 @@
+#ifndef __SCAN_PROCESSOR_H__
+#define __SCAN_PROCESSOR_H__
+
+#include "PackedKeyState.h"
+
+/**
+ * One matrix scan through debounce and keymap:
+ * pack -> DEBOUNCER -> Keymap::tick / execute for each changed key,
+ * with a report queued after every event.
+ *
+ * main.cpp and the host harness (test/) both use this, so the harness
+ * runs the same path as the firmware.
+ */
+template <class DEBOUNCER>
+class ScanProcessor {
+public:
+	typedef typename DEBOUNCER::KeyState KeyState;
+
+private:
+	DEBOUNCER& debouncer;
+	Keymap& keymap;
+	MyUSBKeyboard& keyboard;
+
+	KeyState keysRaw;
+	KeyState keysChanged;
+
+	// queue current key state, sent in order from IN endpoint completion
+	void sendReport() {
+		bool ok = keyboard.queueCurrentReportData();
+		if (!ok) {
+			DEBUG_PRINTF_KEYEVENT("send() failed");
+		}
+	}
+
+public:
+	ScanProcessor(DEBOUNCER& _debouncer, Keymap& _keymap, MyUSBKeyboard& _keyboard) :
+		debouncer(_debouncer),
+		keymap(_keymap),
+		keyboard(_keyboard)
+	{
+		keysRaw.clear();
+		keysChanged.clear();
+	}
+
+	/**
+	 * keys: scan result, one byte per column (KeyboardMatrix format)
+	 * now: ms
+	 * Returns true while keys are down, bouncing or changed, or a tap-hold
+	 * key is pending (the scheduler keeps scanning fast).
+	 */
+	bool process(const uint8_t* keys, const uint32_t now) {
+		bool active = false;
+
+		keysRaw.pack(keys);
+		debouncer.update(keysRaw, now, keysChanged);
+		const KeyState& keysDebounced = debouncer.state();
+
+		// tap-hold timeout and tap release
+		if (keymap.tick(now)) {
+			active = true;
+			sendReport();
+		}
+
+		for (int word = 0; word < KeyState::WORDS; word++) {
+			uint32_t changed = keysChanged.words[word];
+			if (changed) active = true;
+			if (keysDebounced.words[word] || keysRaw.words[word]) active = true;
+			// visit only changed bits
+			while (changed) {
+				const uint8_t bit = KeyState::countTrailingZeros(changed);
+				changed &= changed - 1;
+				const int row = (word * 32 + bit) / KeyState::COLUMNS;
+				const int col = (word * 32 + bit) % KeyState::COLUMNS;
+				bool pressed = keysDebounced.words[word] & (1UL<<bit);
+				DEBUG_PRINTF_KEYEVENT("changed: col=%d, row=%d / pressed=%d\r\n", col, row, pressed);
+				keymap.execute(row, col, pressed);
+				// a report per event keeps press order when keys change on the same scan
+				sendReport();
+			}
+		}
+
+		if (keymap.pending()) active = true;
+
+		return active;
+	}
+};
+
+#endif
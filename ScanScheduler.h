@@ -0,0 +1,307 @@
+#ifndef __SCAN_SCHEDULER_H__
+#define __SCAN_SCHEDULER_H__
+
+#include "mbed.h"
+
+/**
+ * Paces matrix scans with a Ticker instead of wait_ms() in the main loop.
+ *
+ *   MODE_FAST       scan every fastInterval while any key is active
+ *   MODE_SLOW       scan every slowInterval after slowAfter ms without activity
+ *   MODE_INTERRUPT  no scan after stopAfter ms; wakeup() (MCP23017 INT) restarts fast scan
+ *
+ * Main loop:
+ *   if (scheduler.due()) { scan; scheduler.scanned(active, millis); }
+ *
+ * The Ticker only raises a flag, so scan timing follows the ticker and
+ * does not drift with the time spent in scan/keymap/USB.
+ *
+ * With setSofSync(true) and sof() called from USB SOF, fast scans start on
+ * every fastInterval/1ms frame instead, so scans keep a fixed phase to the
+ * host polling. The Ticker stays as fallback while no SOF comes (suspend,
+ * not connected).
+ *
+ * setPhaseLock() also moves the scan start within the frame: the scan is
+ * started `busy + margin` us before the host IN token phase
+ * (setTargetPhase(), us after SOF), where busy is the measured time from
+ * due() to scanned(). So the report is queued just before the host polls
+ * instead of waiting up to one frame.
+ */
+class ScanScheduler {
+public:
+	enum Mode {
+		MODE_FAST,
+		MODE_SLOW,
+		MODE_INTERRUPT
+	};
+
+	/**
+	 * Actual scan start to scan start interval compared to the ticker interval (us)
+	 */
+	struct JitterStats {
+		int32_t last;
+		int32_t min;
+		int32_t max;
+		uint32_t totalAbs;
+		uint32_t count;
+	};
+
+private:
+	Ticker ticker;
+	volatile bool pending;
+	// set by wakeup(), consumed by scanned()
+	volatile bool woken;
+	volatile Mode mode;
+	bool ticking;
+
+	bool sofSync;
+	// SOF came since the last tick
+	volatile bool sofSeen;
+	uint16_t frames;
+	uint16_t framesPerScan;
+
+	bool phaseLock;
+	Timeout phaseTimeout;
+	uint16_t margin;
+	// us after SOF
+	int16_t targetPhase;
+	uint16_t startPhase;
+	// scan + keymap + report time (us), decays slowly from the max
+	uint32_t busy;
+	uint32_t scanStart;
+
+	uint32_t fastInterval;
+	uint32_t slowInterval;
+	uint32_t slowAfter;
+	uint32_t stopAfter;
+
+	uint32_t lastActive;
+	uint32_t lastScan;
+	bool lastScanValid;
+	JitterStats jitter;
+
+	void tick() {
+		if (sofSync && mode == MODE_FAST && sofSeen) {
+			// fast scans are started by sof()
+			sofSeen = false;
+			return;
+		}
+		pending = true;
+	}
+
+	void phaseTick() {
+		pending = true;
+	}
+
+	void updateStartPhase() {
+		int32_t phase = (targetPhase - static_cast<int32_t>(busy + margin)) % 1000;
+		if (phase < 0) phase += 1000;
+		startPhase = phase;
+	}
+
+	void updateFramesPerScan() {
+		framesPerScan = fastInterval / 1000;
+		if (!framesPerScan) framesPerScan = 1;
+	}
+
+	void setMode(const Mode _mode) {
+		ticker.detach();
+		phaseTimeout.detach();
+		mode = _mode;
+		frames = 0;
+		// first interval after a mode change is not a jitter sample
+		lastScanValid = false;
+		if (mode == MODE_INTERRUPT) {
+			ticking = false;
+			// wakeup() ran before it could see MODE_INTERRUPT
+			if (woken) pending = true;
+		} else {
+			ticking = true;
+			ticker.attach_us(this, &ScanScheduler::tick, interval());
+		}
+	}
+
+	void recordJitter(const uint32_t now) {
+		if (lastScanValid) {
+			const int32_t diff = static_cast<int32_t>(now - lastScan) - static_cast<int32_t>(interval());
+			jitter.last = diff;
+			if (!jitter.count || diff < jitter.min) jitter.min = diff;
+			if (!jitter.count || diff > jitter.max) jitter.max = diff;
+			jitter.totalAbs += diff < 0 ? -diff : diff;
+			jitter.count++;
+		}
+		lastScan = now;
+		lastScanValid = true;
+	}
+
+public:
+	/**
+	 * intervals in us, timeouts in ms
+	 */
+	ScanScheduler(const uint32_t _fastInterval, const uint32_t _slowInterval, const uint32_t _slowAfter, const uint32_t _stopAfter) :
+		pending(false),
+		woken(false),
+		mode(MODE_INTERRUPT),
+		ticking(false),
+		sofSync(false),
+		sofSeen(false),
+		frames(0),
+		phaseLock(false),
+		margin(0),
+		targetPhase(0),
+		startPhase(0),
+		busy(0),
+		scanStart(0),
+		fastInterval(_fastInterval),
+		slowInterval(_slowInterval),
+		slowAfter(_slowAfter),
+		stopAfter(_stopAfter),
+		lastActive(0),
+		lastScan(0),
+		lastScanValid(false)
+	{
+		updateFramesPerScan();
+		resetJitter();
+	}
+
+	/**
+	 * Start fast scanning. now: ms
+	 */
+	void start(const uint32_t now) {
+		lastActive = now;
+		setMode(MODE_FAST);
+		pending = true;
+	}
+
+	/**
+	 * From InterruptIn (ISR): a key changed.
+	 * Scans immediately unless fast scanning, and keeps fast scanning.
+	 */
+	void wakeup() {
+		woken = true;
+		if (mode != MODE_FAST) {
+			pending = true;
+		}
+	}
+
+	/**
+	 * From USB SOF (ISR, every 1ms frame).
+	 */
+	void sof() {
+		if (!sofSync || mode != MODE_FAST) return;
+		sofSeen = true;
+		if (++frames >= framesPerScan) {
+			frames = 0;
+			if (phaseLock && startPhase) {
+				phaseTimeout.attach_us(this, &ScanScheduler::phaseTick, startPhase);
+			} else {
+				pending = true;
+			}
+		}
+	}
+
+	/**
+	 * Start fast scans so that they end margin us before targetPhase
+	 * (needs setSofSync(true))
+	 */
+	void setPhaseLock(const bool enable, const uint16_t _margin) {
+		phaseLock = enable;
+		margin = _margin;
+		updateStartPhase();
+	}
+
+	/**
+	 * us after SOF the scan result is wanted (host IN token).
+	 * Negative values (not measured yet) are ignored.
+	 */
+	void setTargetPhase(const int16_t phase) {
+		if (phase < 0 || phase == targetPhase) return;
+		targetPhase = phase;
+		updateStartPhase();
+	}
+
+	uint16_t scanStartPhase() const {
+		return startPhase;
+	}
+
+	uint32_t busyTime() const {
+		return busy;
+	}
+
+	void setSofSync(const bool enable) {
+		sofSync = enable;
+		sofSeen = false;
+	}
+
+	/**
+	 * true once per tick. Clears the tick and records jitter.
+	 */
+	bool due() {
+		if (!pending) return false;
+		pending = false;
+		scanStart = us_ticker_read();
+		recordJitter(scanStart);
+		return true;
+	}
+
+	/**
+	 * Call after each scan.
+	 * active: any key pressed or changed on this scan. now: ms
+	 */
+	void scanned(const bool active, const uint32_t now) {
+		const uint32_t elapsed = us_ticker_read() - scanStart;
+		if (elapsed > busy) {
+			busy = elapsed;
+		} else {
+			busy -= (busy - elapsed) / 16;
+		}
+		if (phaseLock) updateStartPhase();
+
+		if (woken) {
+			woken = false;
+			lastActive = now;
+		}
+		if (active) {
+			lastActive = now;
+		}
+		const uint32_t idle = now - lastActive;
+
+		Mode next;
+		if (idle >= stopAfter) {
+			next = MODE_INTERRUPT;
+		} else if (idle >= slowAfter) {
+			next = MODE_SLOW;
+		} else {
+			next = MODE_FAST;
+		}
+
+		if (next != mode) {
+			setMode(next);
+		}
+	}
+
+	Mode currentMode() const {
+		return mode;
+	}
+
+	uint32_t interval() const {
+		return mode == MODE_SLOW ? slowInterval : fastInterval;
+	}
+
+	void setIntervals(const uint32_t _fastInterval, const uint32_t _slowInterval) {
+		fastInterval = _fastInterval;
+		slowInterval = _slowInterval;
+		updateFramesPerScan();
+		if (ticking) setMode(mode);
+	}
+
+	const JitterStats& jitterStats() const {
+		return jitter;
+	}
+
+	void resetJitter() {
+		memset(&jitter, 0, sizeof(jitter));
+	}
+};
+
+#endif
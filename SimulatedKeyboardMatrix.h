@@ -0,0 +1,146 @@
+#ifndef __SIMULATED_KEYBOARD_MATRIX_H__
+#define __SIMULATED_KEYBOARD_MATRIX_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KeyboardMatrix.h"
+
+/**
+ * Deterministic matrix fed from a key event script. No mbed dependency,
+ * so the scan -> debounce -> keymap -> HID pipeline can be driven on host.
+ *
+ * Script: one event per line, '#' starts a comment
+ *
+ *   # time(ms) row col d(own)/u(p)
+ *   0    3 1 d
+ *   1    3 1 u    <- bounce
+ *   2    3 1 d
+ *   120  3 1 u
+ *
+ * Every scan() advances the simulated clock by scanPeriod ms, then applies
+ * all events whose time has come.
+ */
+class SimulatedKeyboardMatrix : public KeyboardMatrix {
+public:
+	struct Event {
+		uint32_t time;
+		uint8_t row;
+		uint8_t col;
+		bool pressed;
+	};
+
+private:
+	static const uint8_t MAX_COLS = 64;
+	static const uint16_t MAX_EVENTS = 512;
+
+	Event events[MAX_EVENTS];
+	uint16_t eventCount;
+	uint16_t nextEvent;
+
+	uint8_t state[MAX_COLS];
+	const uint8_t colCount;
+	const uint32_t scanPeriod;
+	uint32_t now;
+
+public:
+	SimulatedKeyboardMatrix(const uint8_t _cols, const uint32_t _scanPeriod = 1) :
+		eventCount(0),
+		nextEvent(0),
+		colCount(_cols < MAX_COLS ? _cols : MAX_COLS),
+		scanPeriod(_scanPeriod),
+		now(0)
+	{
+		memset(state, 0, sizeof(state));
+	}
+
+	/**
+	 * Append events from script text. Events must be in time order.
+	 * Returns false on a malformed line or when events overflow.
+	 */
+	bool load(const char* script) {
+		const char* p = script;
+		while (*p) {
+			const char* end = strchr(p, '\n');
+			if (!end) end = p + strlen(p);
+
+			char line[64];
+			size_t len = end - p;
+			if (len >= sizeof(line)) return false;
+			memcpy(line, p, len);
+			line[len] = 0;
+
+			char* comment = strchr(line, '#');
+			if (comment) *comment = 0;
+
+			unsigned long time;
+			unsigned int row, col;
+			char action;
+			int n = sscanf(line, "%lu %u %u %c", &time, &row, &col, &action);
+			if (n == 4) {
+				if (eventCount >= MAX_EVENTS) return false;
+				if (row >= 8 || col >= colCount) return false;
+				Event& e = events[eventCount++];
+				e.time = time;
+				e.row = row;
+				e.col = col;
+				e.pressed = (action == 'd');
+			} else if (n > 0) {
+				return false;
+			}
+
+			p = *end ? end + 1 : end;
+		}
+		return true;
+	}
+
+	bool loadFile(const char* path) {
+		FILE* f = fopen(path, "r");
+		if (!f) return false;
+		bool ok = true;
+		char line[64];
+		while (ok && fgets(line, sizeof(line), f)) {
+			ok = load(line);
+		}
+		fclose(f);
+		return ok;
+	}
+
+	void rewind() {
+		nextEvent = 0;
+		now = 0;
+		memset(state, 0, sizeof(state));
+	}
+
+	virtual void init() {
+		rewind();
+	}
+
+	virtual void scan(uint8_t* keys) {
+		now += scanPeriod;
+		while (nextEvent < eventCount && events[nextEvent].time <= now) {
+			const Event& e = events[nextEvent++];
+			if (e.pressed) {
+				state[e.col] |= 1<<e.row;
+			} else {
+				state[e.col] &= ~(1<<e.row);
+			}
+		}
+		memcpy(keys, state, colCount);
+	}
+
+	virtual uint8_t cols() const {
+		return colCount;
+	}
+
+	// simulated clock (ms)
+	uint32_t time() const {
+		return now;
+	}
+
+	bool finished() const {
+		return nextEvent >= eventCount;
+	}
+};
+
+#endif
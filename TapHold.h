@@ -0,0 +1,170 @@
+#ifndef __TAP_HOLD_H__
+#define __TAP_HOLD_H__
+
+#include <stdint.h>
+
+struct KeyEvent {
+	uint8_t row;
+	uint8_t col;
+	bool pressed;
+	uint32_t time; // ms
+};
+
+/**
+ * Decides whether a tap-hold key (mod-tap / layer-tap) was tapped or held.
+ *
+ * While undecided, following key events are buffered in a fixed size queue
+ * and replayed by the caller after the decision, so that they see the
+ * modifier / layer of a hold.
+ *
+ *   TAP   the key is released within tappingTerm
+ *   HOLD  tappingTerm elapsed (tick())
+ *         another key is pressed (HOLD_ON_OTHER_KEY_PRESS)
+ *         another key is pressed and released (PERMISSIVE_HOLD)
+ *         the queue is full
+ *
+ * So a decision is made within tappingTerm + one scan interval, or
+ * QUEUE_SIZE events, whichever comes first.
+ */
+class TapHold {
+public:
+	enum Decision {
+		UNDECIDED,
+		TAP,
+		HOLD
+	};
+
+	// flags
+	static const uint8_t PERMISSIVE_HOLD = 1<<0;
+	static const uint8_t HOLD_ON_OTHER_KEY_PRESS = 1<<1;
+
+	static const uint8_t QUEUE_SIZE = 8;
+
+private:
+	bool waiting;
+	KeyEvent key;
+	uint16_t action;
+
+	KeyEvent queue[QUEUE_SIZE];
+	uint8_t count;
+
+	uint16_t tappingTerm;
+	uint8_t flags;
+
+	uint32_t lastLatency;
+	uint32_t maxLatency;
+
+	bool isKey(const KeyEvent& e) const {
+		return e.row == key.row && e.col == key.col;
+	}
+
+	// press of the same key is queued before this release
+	bool pressQueued(const KeyEvent& e) const {
+		for (uint8_t i = 0; i < count; i++) {
+			if (queue[i].pressed && queue[i].row == e.row && queue[i].col == e.col) return true;
+		}
+		return false;
+	}
+
+	Decision decide(const Decision decision, const uint32_t now) {
+		if (decision != UNDECIDED) {
+			lastLatency = now - key.time;
+			if (lastLatency > maxLatency) maxLatency = lastLatency;
+		}
+		return decision;
+	}
+
+public:
+	TapHold(const uint16_t _tappingTerm = 200, const uint8_t _flags = PERMISSIVE_HOLD) :
+		waiting(false),
+		action(0),
+		count(0),
+		tappingTerm(_tappingTerm),
+		flags(_flags),
+		lastLatency(0),
+		maxLatency(0)
+	{
+	}
+
+	bool pending() const {
+		return waiting;
+	}
+
+	void start(const uint8_t row, const uint8_t col, const uint16_t _action, const uint32_t now) {
+		waiting = true;
+		key.row = row;
+		key.col = col;
+		key.pressed = true;
+		key.time = now;
+		action = _action;
+		count = 0;
+	}
+
+	/**
+	 * Key event while pending(). The event is queued (except the release of
+	 * the tap-hold key decided as TAP) and must be replayed after a decision.
+	 */
+	Decision event(const KeyEvent& e) {
+		if (isKey(e) && !e.pressed) {
+			if (e.time - key.time < tappingTerm) {
+				return decide(TAP, e.time);
+			}
+			queue[count++] = e;
+			return decide(HOLD, e.time);
+		}
+
+		// keep room for the release of the tap-hold key
+		if (count >= QUEUE_SIZE - 1) {
+			queue[count++] = e;
+			return decide(HOLD, e.time);
+		}
+
+		const bool permissive = (flags & PERMISSIVE_HOLD) && !e.pressed && pressQueued(e);
+		queue[count++] = e;
+
+		if (e.pressed && (flags & HOLD_ON_OTHER_KEY_PRESS)) {
+			return decide(HOLD, e.time);
+		}
+		if (permissive) {
+			return decide(HOLD, e.time);
+		}
+		return UNDECIDED;
+	}
+
+	/**
+	 * Call every scan with current time
+	 */
+	Decision tick(const uint32_t now) {
+		if (waiting && now - key.time >= tappingTerm) {
+			return decide(HOLD, now);
+		}
+		return UNDECIDED;
+	}
+
+	/**
+	 * Take the decided key and the queued events (copied to out, returns count)
+	 * and become idle.
+	 */
+	uint8_t finish(KeyEvent& _key, uint16_t& _action, KeyEvent (&out)[QUEUE_SIZE]) {
+		_key = key;
+		_action = action;
+		for (uint8_t i = 0; i < count; i++) {
+			out[i] = queue[i];
+		}
+		const uint8_t n = count;
+		count = 0;
+		waiting = false;
+		return n;
+	}
+
+	// ms from tap-hold key press to decision
+	uint32_t latency() const {
+		return lastLatency;
+	}
+
+	uint32_t maxLatencyMs() const {
+		return maxLatency;
+	}
+};
+
+#endif
@@ -0,0 +1,307 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "stdint.h"
+#include "USBCDCFunction.h"
+
+#define CDC_SET_LINE_CODING        0x20
+#define CDC_GET_LINE_CODING        0x21
+#define CDC_SET_CONTROL_LINE_STATE 0x22
+
+// Control Line State bits
+#define CLS_DTR   (1 << 0)
+#define CLS_RTS   (1 << 1)
+
+#define MAX_CDC_REPORT_SIZE MAX_PACKET_SIZE_EPBULK
+
+#define TOTAL_DESCRIPTOR_LENGTH (INTERFACE_ASSOCIATION_DESCRIPTOR_LENGTH \
+                               + (2 * INTERFACE_DESCRIPTOR_LENGTH) \
+                               + 5 + 5 + 4 + 5 \
+                               + (3 * ENDPOINT_DESCRIPTOR_LENGTH))
+
+// logical endpoints of this function
+#define NOTIFICATION_ENDPOINT 0
+#define DATA_ENDPOINT 1
+
+
+USBCDCFunction::USBCDCFunction(): USBFunction(2, 2) {
+    static const uint8_t defaultLineCoding[7] = {0x80, 0x25, 0x00, 0x00, 0x00, 0x00, 0x08};
+    memcpy(lineCoding, defaultLineCoding, sizeof(lineCoding));
+    txDropped = 0;
+    txZlp = false;
+    terminalConnected = false;
+}
+
+void USBCDCFunction::startTransfer() {
+    uint8_t packet[MAX_CDC_REPORT_SIZE];
+
+    while (!tx.isEmpty() || txZlp) {
+        uint16_t size = tx.available();
+        if (size > MAX_CDC_REPORT_SIZE) {
+            size = MAX_CDC_REPORT_SIZE;
+        }
+        for (uint16_t i = 0; i < size; i++) {
+            packet[i] = *tx.at(i);
+        }
+        if (!device->writeAsync(endpointIn(DATA_ENDPOINT), packet, size, MAX_CDC_REPORT_SIZE)) {
+            // no free buffer: sent on completion
+            return;
+        }
+        for (uint16_t i = 0; i < size; i++) {
+            tx.drop();
+        }
+        // a full packet does not end the transfer: the host waits for a
+        // short one, so a zero length packet follows unless more data does
+        txZlp = (size == MAX_CDC_REPORT_SIZE);
+    }
+}
+
+uint16_t USBCDCFunction::write(const uint8_t * buf, uint16_t size) {
+    uint16_t queued = 0;
+
+    if (!configured() || !terminalConnected) {
+        return 0;
+    }
+
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    while (queued < size) {
+        uint8_t * slot = tx.reserve();
+        if (slot == NULL) {
+            txDropped += size - queued;
+            break;
+        }
+        *slot = buf[queued++];
+        tx.commit();
+    }
+    startTransfer();
+
+    __set_PRIMASK(primask);
+    return queued;
+}
+
+int USBCDCFunction::_putc(int c) {
+    uint8_t data = c;
+    return write(&data, 1) ? c : -1;
+}
+
+int USBCDCFunction::_getc() {
+    uint8_t c = 0;
+    while (rx.isEmpty());
+    rx.dequeue(&c);
+    return c;
+}
+
+uint16_t USBCDCFunction::available() {
+    return rx.available();
+}
+
+bool USBCDCFunction::connected() {
+    return terminalConnected;
+}
+
+
+uint16_t USBCDCFunction::descriptorLength() {
+    return TOTAL_DESCRIPTOR_LENGTH;
+}
+
+void USBCDCFunction::writeDescriptors(uint8_t * buffer) {
+    const uint8_t notification = PHY_TO_DESC(endpointIn(NOTIFICATION_ENDPOINT));
+    const uint8_t in = PHY_TO_DESC(endpointIn(DATA_ENDPOINT));
+    const uint8_t out = PHY_TO_DESC(endpointOut(DATA_ENDPOINT));
+
+    uint8_t descriptors[] = {
+        // IAD to associate the two CDC interfaces
+        INTERFACE_ASSOCIATION_DESCRIPTOR_LENGTH,    // bLength
+        INTERFACE_ASSOCIATION_DESCRIPTOR,           // bDescriptorType
+        firstInterface(),                           // bFirstInterface
+        0x02,                                       // bInterfaceCount
+        0x02,                                       // bFunctionClass
+        0x02,                                       // bFunctionSubClass
+        0,                                          // bFunctionProtocol
+        0,                                          // iFunction
+
+        // interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+        INTERFACE_DESCRIPTOR_LENGTH,    // bLength
+        INTERFACE_DESCRIPTOR,           // bDescriptorType
+        firstInterface(),               // bInterfaceNumber
+        0,                              // bAlternateSetting
+        1,                              // bNumEndpoints
+        0x02,                           // bInterfaceClass
+        0x02,                           // bInterfaceSubClass
+        0x01,                           // bInterfaceProtocol
+        0,                              // iInterface
+
+        // CDC Header Functional Descriptor, CDC Spec 5.2.3.1, Table 26
+        5,                              // bFunctionLength
+        0x24,                           // bDescriptorType
+        0x00,                           // bDescriptorSubtype
+        0x10, 0x01,                     // bcdCDC
+
+        // Call Management Functional Descriptor, CDC Spec 5.2.3.2, Table 27
+        5,                              // bFunctionLength
+        0x24,                           // bDescriptorType
+        0x01,                           // bDescriptorSubtype
+        0x03,                           // bmCapabilities
+        (uint8_t)(firstInterface() + 1),// bDataInterface
+
+        // Abstract Control Management Functional Descriptor, CDC Spec 5.2.3.3, Table 28
+        4,                              // bFunctionLength
+        0x24,                           // bDescriptorType
+        0x02,                           // bDescriptorSubtype
+        0x06,                           // bmCapabilities
+
+        // Union Functional Descriptor, CDC Spec 5.2.3.8, Table 33
+        5,                              // bFunctionLength
+        0x24,                           // bDescriptorType
+        0x06,                           // bDescriptorSubtype
+        firstInterface(),               // bMasterInterface
+        (uint8_t)(firstInterface() + 1),// bSlaveInterface0
+
+        // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+        ENDPOINT_DESCRIPTOR_LENGTH,                     // bLength
+        ENDPOINT_DESCRIPTOR,                            // bDescriptorType
+        notification,                                   // bEndpointAddress
+        E_INTERRUPT,                                    // bmAttributes (0x03=intr)
+        LSB(MAX_PACKET_SIZE_EPINT),                     // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPINT),                     // wMaxPacketSize (MSB)
+        16,                                             // bInterval
+
+        // interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+        INTERFACE_DESCRIPTOR_LENGTH,    // bLength
+        INTERFACE_DESCRIPTOR,           // bDescriptorType
+        (uint8_t)(firstInterface() + 1),// bInterfaceNumber
+        0,                              // bAlternateSetting
+        2,                              // bNumEndpoints
+        0x0A,                           // bInterfaceClass
+        0x00,                           // bInterfaceSubClass
+        0x00,                           // bInterfaceProtocol
+        0,                              // iInterface
+
+        // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+        ENDPOINT_DESCRIPTOR_LENGTH,             // bLength
+        ENDPOINT_DESCRIPTOR,                    // bDescriptorType
+        in,                                     // bEndpointAddress
+        E_BULK,                                 // bmAttributes (0x02=bulk)
+        LSB(MAX_PACKET_SIZE_EPBULK),            // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPBULK),            // wMaxPacketSize (MSB)
+        0,                                      // bInterval
+
+        // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+        ENDPOINT_DESCRIPTOR_LENGTH,              // bLength
+        ENDPOINT_DESCRIPTOR,                     // bDescriptorType
+        out,                                     // bEndpointAddress
+        E_BULK,                                  // bmAttributes (0x02=bulk)
+        LSB(MAX_PACKET_SIZE_EPBULK),             // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPBULK),             // wMaxPacketSize (MSB)
+        0                                        // bInterval
+    };
+    memcpy(buffer, descriptors, sizeof(descriptors));
+}
+
+
+// Called in ISR context
+bool USBCDCFunction::request(CONTROL_TRANSFER * transfer) {
+    bool success = false;
+
+    /* Process class-specific requests */
+
+    if (transfer->setup.bmRequestType.Type == CLASS_TYPE) {
+        switch (transfer->setup.bRequest) {
+            case CDC_GET_LINE_CODING:
+                transfer->remaining = 7;
+                transfer->ptr = lineCoding;
+                transfer->direction = DEVICE_TO_HOST;
+                success = true;
+                break;
+            case CDC_SET_LINE_CODING:
+                transfer->remaining = 7;
+                transfer->notify = true;
+                success = true;
+                break;
+            case CDC_SET_CONTROL_LINE_STATE:
+                terminalConnected = (transfer->setup.wValue & CLS_DTR) != 0;
+                if (!terminalConnected) {
+                    // nobody reads stale output
+                    while (!tx.isEmpty()) tx.drop();
+                }
+                success = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return success;
+}
+
+// Called in ISR context
+void USBCDCFunction::requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length) {
+    // Request of setting line coding has 7 bytes
+    if ((length == 7) && (transfer->setup.bRequest == CDC_SET_LINE_CODING)) {
+        memcpy(lineCoding, buf, 7);
+    }
+}
+
+// Called in ISR context
+bool USBCDCFunction::setConfiguration(void) {
+    // Configure endpoints > 0 (fails when they do not fit in USB RAM)
+    if (!device->addEndpoint(endpointIn(NOTIFICATION_ENDPOINT), MAX_PACKET_SIZE_EPINT)
+        || !device->addEndpoint(endpointIn(DATA_ENDPOINT), MAX_PACKET_SIZE_EPBULK)
+        || !device->addEndpoint(endpointOut(DATA_ENDPOINT), MAX_PACKET_SIZE_EPBULK))
+    {
+        return false;
+    }
+
+    // We activate the endpoint to be able to recceive data
+    device->readStart(endpointOut(DATA_ENDPOINT), MAX_PACKET_SIZE_EPBULK);
+    return true;
+}
+
+// Called in ISR context
+void USBCDCFunction::busReset(void) {
+    terminalConnected = false;
+    while (!tx.isEmpty()) tx.drop();
+    txZlp = false;
+}
+
+// Called in ISR context
+bool USBCDCFunction::endpointCallback(uint8_t endpoint) {
+    if (endpoint == endpointIn(DATA_ENDPOINT)) {
+        startTransfer();
+        return true;
+    }
+
+    if (endpoint == endpointOut(DATA_ENDPOINT)) {
+        uint8_t c[MAX_CDC_REPORT_SIZE + 1];
+        uint32_t size = 0;
+
+        // we read the packet received and put it on the circular buffer
+        device->readEP(endpointOut(DATA_ENDPOINT), c, &size, MAX_CDC_REPORT_SIZE);
+        for (uint32_t i = 0; i < size; i++) {
+            rx.queue(c[i]);
+        }
+
+        // We reactivate the endpoint to receive next characters
+        device->readStart(endpointOut(DATA_ENDPOINT), MAX_CDC_REPORT_SIZE);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,105 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef USBCDCFUNCTION_H
+#define USBCDCFUNCTION_H
+
+#include "USBComposite.h"
+#include "Stream.h"
+#include "CircBuffer.h"
+
+/**
+ * Virtual serial port (CDC ACM) of a USBComposite device: control
+ * interface with an interrupt IN endpoint and data interface with bulk
+ * IN / OUT, tied together with an IAD.
+ *
+ * Unlike USBSerial, writing never blocks: characters go to a ring buffer
+ * which is sent from the bulk IN completion, up to one packet per buffer
+ * of the endpoint. Output is dropped while no terminal is open (DTR) or
+ * the buffer is full, so it can be used for diagnostics next to a
+ * latency sensitive function.
+ */
+class USBCDCFunction: public USBFunction, public Stream {
+public:
+    static const uint16_t TX_BUFFER_SIZE = 512;
+    static const uint16_t RX_BUFFER_SIZE = 64;
+
+    USBCDCFunction();
+
+    /**
+    * Send a character. You can use puts, printf.
+    *
+    * @returns c, -1 if it was dropped
+    */
+    virtual int _putc(int c);
+
+    /**
+    * Read a character: blocking
+    *
+    * @returns character read
+    */
+    virtual int _getc();
+
+    /**
+    * Queue a block of data. warning: non blocking
+    *
+    * @returns number of bytes queued
+    */
+    uint16_t write(const uint8_t * buf, uint16_t size);
+
+    /**
+    * Check the number of bytes available.
+    *
+    * @returns the number of bytes available
+    */
+    uint16_t available();
+
+    /**
+    * Check if the terminal is connected (DTR).
+    *
+    * @returns connection status
+    */
+    bool connected();
+
+    int readable() { return available() ? 1 : 0; }
+
+    /* bytes dropped because the TX buffer was full */
+    uint32_t dropped() const { return txDropped; }
+
+    virtual uint16_t descriptorLength();
+    virtual void writeDescriptors(uint8_t * buffer);
+    virtual bool request(CONTROL_TRANSFER * transfer);
+    virtual void requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length);
+    virtual bool setConfiguration(void);
+    virtual void busReset(void);
+    virtual bool endpointCallback(uint8_t endpoint);
+
+private:
+    /* IRQ disabled or ISR context. Hands buffered data to bulk IN */
+    void startTransfer();
+
+    CircBuffer<uint8_t, TX_BUFFER_SIZE> tx;
+    CircBuffer<uint8_t, RX_BUFFER_SIZE> rx;
+    volatile uint32_t txDropped;
+    /* last packet was full size: a zero length packet ends the transfer */
+    bool txZlp;
+    volatile bool terminalConnected;
+    uint8_t lineCoding[7];
+};
+
+#endif
@@ -0,0 +1,231 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "stdint.h"
+#include "USBComposite.h"
+
+#define DEFAULT_CONFIGURATION (1)
+
+
+bool USBFunction::configured(void) {
+    return (device != NULL) && device->configured();
+}
+
+
+USBComposite::USBComposite(uint16_t vendor_id, uint16_t product_id, uint16_t product_release): USBDevice(vendor_id, product_id, product_release)
+{
+    functionCount = 0;
+    interfaceCount = 0;
+    endpointCount = 1;
+    requestOwner = NULL;
+    memset(functions, 0, sizeof(functions));
+    memset(endpointOwner, 0, sizeof(endpointOwner));
+
+    configurationLength = CONFIGURATION_DESCRIPTOR_LENGTH;
+    configurationDescriptor[0] = CONFIGURATION_DESCRIPTOR_LENGTH;  // bLength
+    configurationDescriptor[1] = CONFIGURATION_DESCRIPTOR;         // bDescriptorType
+    configurationDescriptor[2] = LSB(configurationLength);         // wTotalLength (LSB)
+    configurationDescriptor[3] = MSB(configurationLength);         // wTotalLength (MSB)
+    configurationDescriptor[4] = 0x00;                             // bNumInterfaces
+    configurationDescriptor[5] = DEFAULT_CONFIGURATION;            // bConfigurationValue
+    configurationDescriptor[6] = 0x00;                             // iConfiguration
+    configurationDescriptor[7] = C_RESERVED | C_SELF_POWERED;      // bmAttributes
+    configurationDescriptor[8] = C_POWER(0);                       // bMaxPower
+}
+
+bool USBComposite::add(USBFunction * function)
+{
+    uint16_t length = function->descriptorLength();
+
+    if ((functionCount >= MAX_FUNCTIONS) \
+        || (endpointCount + function->endpointCount() > NUMBER_OF_LOGICAL_ENDPOINTS) \
+        || (configurationLength + length > MAX_DESCRIPTOR_LENGTH))
+    {
+        return false;
+    }
+
+    function->device = this;
+    function->interfaceBase = interfaceCount;
+    function->endpointBase = endpointCount;
+    function->writeDescriptors(&configurationDescriptor[configurationLength]);
+
+    for (uint8_t i = 0; i < function->endpointCount(); i++)
+    {
+        endpointOwner[endpointCount + i] = function;
+    }
+    functions[functionCount++] = function;
+    interfaceCount += function->interfaceCount();
+    endpointCount += function->endpointCount();
+    configurationLength += length;
+
+    configurationDescriptor[2] = LSB(configurationLength);
+    configurationDescriptor[3] = MSB(configurationLength);
+    configurationDescriptor[4] = interfaceCount;
+    return true;
+}
+
+USBFunction * USBComposite::interfaceOwner(uint16_t interface)
+{
+    for (uint8_t i = 0; i < functionCount; i++)
+    {
+        if (functions[i]->ownsInterface(interface))
+        {
+            return functions[i];
+        }
+    }
+    return NULL;
+}
+
+uint8_t * USBComposite::deviceDesc() {
+    // Functions made of several interfaces come with an IAD
+    bool iad = false;
+    for (uint8_t i = 0; i < functionCount; i++)
+    {
+        if (functions[i]->interfaceCount() > 1)
+        {
+            iad = true;
+        }
+    }
+
+    deviceDescriptor[0] = DEVICE_DESCRIPTOR_LENGTH;                 // bLength
+    deviceDescriptor[1] = DEVICE_DESCRIPTOR;                        // bDescriptorType
+    deviceDescriptor[2] = LSB(USB_VERSION_2_0);                     // bcdUSB (LSB)
+    deviceDescriptor[3] = MSB(USB_VERSION_2_0);                     // bcdUSB (MSB)
+    deviceDescriptor[4] = iad ? 0xEF : 0x00;                        // bDeviceClass (Miscellaneous)
+    deviceDescriptor[5] = iad ? 0x02 : 0x00;                        // bDeviceSubClass (Common Class)
+    deviceDescriptor[6] = iad ? 0x01 : 0x00;                        // bDeviceProtocol (IAD)
+    deviceDescriptor[7] = MAX_PACKET_SIZE_EP0;                      // bMaxPacketSize0
+    deviceDescriptor[8] = LSB(VENDOR_ID);                           // idVendor (LSB)
+    deviceDescriptor[9] = MSB(VENDOR_ID);                           // idVendor (MSB)
+    deviceDescriptor[10] = LSB(PRODUCT_ID);                         // idProduct (LSB)
+    deviceDescriptor[11] = MSB(PRODUCT_ID);                         // idProduct (MSB)
+    deviceDescriptor[12] = LSB(PRODUCT_RELEASE);                    // bcdDevice (LSB)
+    deviceDescriptor[13] = MSB(PRODUCT_RELEASE);                    // bcdDevice (MSB)
+    deviceDescriptor[14] = STRING_OFFSET_IMANUFACTURER;             // iManufacturer
+    deviceDescriptor[15] = STRING_OFFSET_IPRODUCT;                  // iProduct
+    deviceDescriptor[16] = STRING_OFFSET_ISERIAL;                   // iSerialNumber
+    deviceDescriptor[17] = 0x01;                                    // bNumConfigurations
+    return deviceDescriptor;
+}
+
+uint8_t * USBComposite::configurationDesc() {
+    return configurationDescriptor;
+}
+
+
+//
+//  Route callbacks from lower layers to functions
+//
+
+
+// Called in ISR context
+// Interface / endpoint requests go to their owner, device requests
+// (e.g. vendor specific) to the first function which handles them
+bool USBComposite::USBCallback_request() {
+    CONTROL_TRANSFER * transfer = getTransferPtr();
+    USBFunction * function = NULL;
+    uint8_t endpoint;
+
+    requestOwner = NULL;
+
+    switch (transfer->setup.bmRequestType.Recipient)
+    {
+        case INTERFACE_RECIPIENT:
+            function = interfaceOwner(LSB(transfer->setup.wIndex));
+            break;
+        case ENDPOINT_RECIPIENT:
+            endpoint = transfer->setup.wIndex & 0x0f;
+            if (endpoint < NUMBER_OF_LOGICAL_ENDPOINTS)
+            {
+                function = endpointOwner[endpoint];
+            }
+            break;
+        default:
+            for (uint8_t i = 0; i < functionCount; i++)
+            {
+                if (functions[i]->request(transfer))
+                {
+                    requestOwner = functions[i];
+                    return true;
+                }
+            }
+            return false;
+    }
+
+    if ((function != NULL) && function->request(transfer))
+    {
+        requestOwner = function;
+        return true;
+    }
+    return false;
+}
+
+// Called in ISR context
+void USBComposite::USBCallback_requestCompleted(uint8_t * buf, uint32_t length) {
+    if (requestOwner != NULL)
+    {
+        requestOwner->requestCompleted(getTransferPtr(), buf, length);
+    }
+}
+
+// Called in ISR context
+// Set configuration. Return false if the
+// configuration is not supported
+bool USBComposite::USBCallback_setConfiguration(uint8_t configuration) {
+    if (configuration != DEFAULT_CONFIGURATION) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < functionCount; i++)
+    {
+        if (!functions[i]->setConfiguration())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Called in ISR context
+bool USBComposite::USBCallback_setInterface(uint16_t interface, uint8_t alternate) {
+    USBFunction * function = interfaceOwner(interface);
+    return (function != NULL) && function->setInterface(interface, alternate);
+}
+
+// Called in ISR context
+void USBComposite::USBCallback_busReset(void) {
+    requestOwner = NULL;
+    for (uint8_t i = 0; i < functionCount; i++)
+    {
+        functions[i]->busReset();
+    }
+}
+
+// Called in ISR context
+void USBComposite::SOF(int frameNumber) {
+    for (uint8_t i = 0; i < functionCount; i++)
+    {
+        functions[i]->SOF(frameNumber);
+    }
+}
+
+// Called in ISR context
+bool USBComposite::endpointCallback(uint8_t endpoint) {
+    USBFunction * function = endpointOwner[endpoint >> 1];
+    return (function != NULL) && function->endpointCallback(endpoint);
+}
@@ -0,0 +1,129 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef USBCOMPOSITE_H
+#define USBCOMPOSITE_H
+
+#include "USBDevice.h"
+#include "USBFunction.h"
+
+/* Interface association descriptor (USB ECN, IAD) */
+#define INTERFACE_ASSOCIATION_DESCRIPTOR        (0x0B)
+#define INTERFACE_ASSOCIATION_DESCRIPTOR_LENGTH (0x08)
+
+/**
+ * Device made of several class drivers (USBFunction).
+ *
+ * Interface numbers and logical endpoints are given to functions in the
+ * order they are added, and the configuration descriptor is built from
+ * their descriptors. Requests and endpoint callbacks are routed to the
+ * function which owns the interface / endpoint.
+ *
+ * @code
+ * USBComposite usb(0x1235, 0x0050, 0x0001);
+ * MyUSBKeyboard keyboard;      // USBHIDFunction
+ * USBCDCFunction console;
+ *
+ * int main(void) {
+ *     usb.add(&keyboard);
+ *     usb.add(&console);
+ *     usb.connect();
+ *     console.printf("hello\r\n");
+ * }
+ * @endcode
+ */
+class USBComposite: public USBDevice {
+public:
+    static const uint8_t MAX_FUNCTIONS = 4;
+    /* configuration descriptor of all functions */
+    static const uint16_t MAX_DESCRIPTOR_LENGTH = 256;
+
+    USBComposite(uint16_t vendor_id = 0x1234, uint16_t product_id = 0x0006, uint16_t product_release = 0x0001);
+
+    /*
+    * Add a function. Must be called before connect().
+    *
+    * @returns false if interfaces, endpoints or descriptor space run out
+    */
+    bool add(USBFunction * function);
+
+    /*
+    * Find the function which owns an interface
+    *
+    * @returns function, NULL if none
+    */
+    USBFunction * interfaceOwner(uint16_t interface);
+
+    virtual uint8_t * deviceDesc();
+    virtual uint8_t * configurationDesc();
+
+protected:
+    virtual bool USBCallback_request();
+    virtual void USBCallback_requestCompleted(uint8_t * buf, uint32_t length);
+    virtual bool USBCallback_setConfiguration(uint8_t configuration);
+    virtual bool USBCallback_setInterface(uint16_t interface, uint8_t alternate);
+    virtual void USBCallback_busReset(void);
+    virtual void SOF(int frameNumber);
+
+    /* Route EPx_OUT/IN_callback to the owner of logical endpoint x */
+#define USBCOMPOSITE_ROUTE(n) \
+    virtual bool EP##n##_OUT_callback() { return endpointCallback((n) << 1); }; \
+    virtual bool EP##n##_IN_callback() { return endpointCallback(((n) << 1) | 1); };
+
+#if !(defined(TARGET_NUMAKER_PFM_NUC472) || defined(TARGET_NUMAKER_PFM_M453))
+    USBCOMPOSITE_ROUTE(1)
+    USBCOMPOSITE_ROUTE(2)
+    USBCOMPOSITE_ROUTE(3)
+#if !defined(TARGET_STM32F4)
+    USBCOMPOSITE_ROUTE(4)
+#if !(defined(TARGET_LPC11UXX) || defined(TARGET_LPC11U6X) || defined(TARGET_LPC1347) || defined(TARGET_LPC1549))
+    USBCOMPOSITE_ROUTE(5)
+    USBCOMPOSITE_ROUTE(6)
+    USBCOMPOSITE_ROUTE(7)
+    USBCOMPOSITE_ROUTE(8)
+    USBCOMPOSITE_ROUTE(9)
+    USBCOMPOSITE_ROUTE(10)
+    USBCOMPOSITE_ROUTE(11)
+    USBCOMPOSITE_ROUTE(12)
+    USBCOMPOSITE_ROUTE(13)
+    USBCOMPOSITE_ROUTE(14)
+    USBCOMPOSITE_ROUTE(15)
+#endif
+#endif
+#endif
+#undef USBCOMPOSITE_ROUTE
+
+private:
+    bool endpointCallback(uint8_t endpoint);
+
+    USBFunction * functions[MAX_FUNCTIONS];
+    uint8_t functionCount;
+    uint8_t interfaceCount;
+    /* logical endpoints given out, EP0 included */
+    uint8_t endpointCount;
+    /* owner of each logical endpoint (NULL: EP0 / unused) */
+    USBFunction * endpointOwner[NUMBER_OF_LOGICAL_ENDPOINTS];
+    /* function which took the current Endpoint0 request */
+    USBFunction * requestOwner;
+
+    uint8_t deviceDescriptor[DEVICE_DESCRIPTOR_LENGTH];
+    uint8_t configurationDescriptor[MAX_DESCRIPTOR_LENGTH];
+    uint16_t configurationLength;
+};
+
+#endif
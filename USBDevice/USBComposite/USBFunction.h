@@ -0,0 +1,146 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef USBFUNCTION_H
+#define USBFUNCTION_H
+
+#include "USBEndpoints.h"
+#include "USBDescriptor.h"
+#include "USBDevice_Types.h"
+
+class USBComposite;
+
+/**
+ * Class driver (one function) of a USBComposite device.
+ *
+ * A function owns interfaceCount() consecutive interface numbers and
+ * endpointCount() consecutive logical endpoints (IN and OUT of each),
+ * assigned by USBComposite::add(). Descriptors are written with
+ * firstInterface() and endpointIn()/endpointOut(), so functions can be
+ * combined in any order without editing descriptors by hand.
+ *
+ * Callbacks are the USBDevice ones, routed by USBComposite:
+ *   request()          interface / endpoint recipient: owner only,
+ *                      device recipient: each function until one takes it
+ *   requestCompleted() the function which took the request
+ *   endpointCallback() EPx_OUT/IN_callback of own endpoints
+ *   setConfiguration(), busReset(), SOF() every function
+ * All of them are called in ISR context.
+ */
+class USBFunction {
+public:
+    USBFunction(uint8_t interfaces, uint8_t endpoints):
+        device(NULL),
+        interfaces(interfaces),
+        endpoints(endpoints),
+        interfaceBase(0),
+        endpointBase(0)
+    {
+    }
+
+    virtual ~USBFunction() {}
+
+    uint8_t interfaceCount() const { return interfaces; }
+    uint8_t endpointCount() const { return endpoints; }
+
+    /*
+    * Number of the first interface of this function (valid after USBComposite::add())
+    */
+    uint8_t firstInterface() const { return interfaceBase; }
+
+    bool ownsInterface(uint16_t interface) const {
+        return (interface >= interfaceBase) && (interface < interfaceBase + interfaces);
+    }
+
+    /*
+    * Check if the device is configured
+    */
+    bool configured(void);
+
+    /*
+    * Length of descriptors of this function (interface association,
+    * interface, class specific and endpoint descriptors)
+    */
+    virtual uint16_t descriptorLength() = 0;
+
+    /*
+    * Write descriptors of this function (descriptorLength() bytes).
+    * The buffer stays valid, so a function may keep pointers into it
+    * (e.g. HID descriptor).
+    */
+    virtual void writeDescriptors(uint8_t * buffer) = 0;
+
+    /*
+    * Endpoint0 request. Same as USBDevice::USBCallback_request()
+    *
+    * @returns true if function handles this request
+    */
+    virtual bool request(CONTROL_TRANSFER * transfer) { return false; };
+
+    /*
+    * Data stage of a request taken with transfer->notify set
+    */
+    virtual void requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length) {};
+
+    /*
+    * Add own endpoints (configuration 1)
+    *
+    * @returns true if successful
+    */
+    virtual bool setConfiguration(void) = 0;
+
+    /*
+    * Set alternate setting of an own interface
+    *
+    * @returns true if function handles this request
+    */
+    virtual bool setInterface(uint16_t interface, uint8_t alternate) { return false; };
+
+    virtual void busReset(void) {};
+
+    virtual void SOF(int frameNumber) {};
+
+    /*
+    * Transfer of an own endpoint completed (EPx_OUT/IN_callback)
+    *
+    * @param endpoint physical endpoint
+    * @returns true if handled
+    */
+    virtual bool endpointCallback(uint8_t endpoint) { return false; };
+
+protected:
+    /*
+    * Physical endpoint numbers of the n-th own logical endpoint
+    */
+    uint8_t endpointOut(uint8_t n) const { return (endpointBase + n) << 1; }
+    uint8_t endpointIn(uint8_t n) const { return ((endpointBase + n) << 1) | 1; }
+
+    /* NULL until added to a device */
+    USBComposite * device;
+
+private:
+    friend class USBComposite;
+
+    uint8_t interfaces;
+    uint8_t endpoints;
+    uint8_t interfaceBase;
+    /* first logical endpoint */
+    uint8_t endpointBase;
+};
+
+#endif
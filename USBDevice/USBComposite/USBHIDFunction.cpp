@@ -0,0 +1,201 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "stdint.h"
+#include "USBHIDFunction.h"
+
+#define TOTAL_DESCRIPTOR_LENGTH ((1 * INTERFACE_DESCRIPTOR_LENGTH) \
+                               + (1 * HID_DESCRIPTOR_LENGTH) \
+                               + (2 * ENDPOINT_DESCRIPTOR_LENGTH))
+
+
+USBHIDFunction::USBHIDFunction(uint8_t subclass, uint8_t protocol, uint8_t interval): USBFunction(1, 1)
+{
+    this->subclass = subclass;
+    this->protocol = protocol;
+    this->interval = interval;
+    reportLength = 0;
+    hidDescriptor = NULL;
+    outputReport.length = 0;
+}
+
+
+bool USBHIDFunction::sendAsync(HID_REPORT *report)
+{
+    return device->writeAsync(endpointIn(0), report->data, report->length, MAX_HID_REPORT_SIZE);
+}
+
+
+uint16_t USBHIDFunction::reportDescLength() {
+    reportDesc();
+    return reportLength;
+}
+
+
+uint16_t USBHIDFunction::descriptorLength() {
+    return TOTAL_DESCRIPTOR_LENGTH;
+}
+
+void USBHIDFunction::writeDescriptors(uint8_t * buffer) {
+    const uint8_t in = PHY_TO_DESC(endpointIn(0));
+    const uint8_t out = PHY_TO_DESC(endpointOut(0));
+
+    uint8_t descriptors[] = {
+        INTERFACE_DESCRIPTOR_LENGTH,        // bLength
+        INTERFACE_DESCRIPTOR,               // bDescriptorType
+        firstInterface(),                   // bInterfaceNumber
+        0x00,                               // bAlternateSetting
+        0x02,                               // bNumEndpoints
+        HID_CLASS,                          // bInterfaceClass
+        subclass,                           // bInterfaceSubClass
+        protocol,                           // bInterfaceProtocol
+        0x00,                               // iInterface
+
+        HID_DESCRIPTOR_LENGTH,              // bLength
+        HID_DESCRIPTOR,                     // bDescriptorType
+        LSB(HID_VERSION_1_11),              // bcdHID (LSB)
+        MSB(HID_VERSION_1_11),              // bcdHID (MSB)
+        0x00,                               // bCountryCode
+        0x01,                               // bNumDescriptors
+        REPORT_DESCRIPTOR,                  // bDescriptorType
+        (uint8_t)(LSB(reportDescLength())), // wDescriptorLength (LSB)
+        (uint8_t)(MSB(reportDescLength())), // wDescriptorLength (MSB)
+
+        ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
+        ENDPOINT_DESCRIPTOR,                // bDescriptorType
+        in,                                 // bEndpointAddress
+        E_INTERRUPT,                        // bmAttributes
+        LSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (MSB)
+        interval,                           // bInterval (milliseconds)
+
+        ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
+        ENDPOINT_DESCRIPTOR,                // bDescriptorType
+        out,                                // bEndpointAddress
+        E_INTERRUPT,                        // bmAttributes
+        LSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPINT),         // wMaxPacketSize (MSB)
+        interval,                           // bInterval (milliseconds)
+    };
+    memcpy(buffer, descriptors, sizeof(descriptors));
+    hidDescriptor = buffer + INTERFACE_DESCRIPTOR_LENGTH;
+}
+
+
+// Called in ISR context
+// Requests to this interface: descriptors and SET_REPORT
+// Return true if class handles this request
+bool USBHIDFunction::request(CONTROL_TRANSFER * transfer) {
+    bool success = false;
+
+    // Process additional standard requests
+
+    if ((transfer->setup.bmRequestType.Type == STANDARD_TYPE))
+    {
+        switch (transfer->setup.bRequest)
+        {
+            case GET_DESCRIPTOR:
+                switch (DESCRIPTOR_TYPE(transfer->setup.wValue))
+                {
+                    case REPORT_DESCRIPTOR:
+                        if ((reportDesc() != NULL) \
+                            && (reportDescLength() != 0))
+                        {
+                            transfer->remaining = reportDescLength();
+                            transfer->ptr = reportDesc();
+                            transfer->direction = DEVICE_TO_HOST;
+                            success = true;
+                        }
+                        break;
+                    case HID_DESCRIPTOR:
+                        if (hidDescriptor != NULL)
+                        {
+                            transfer->remaining = HID_DESCRIPTOR_LENGTH;
+                            transfer->ptr = hidDescriptor;
+                            transfer->direction = DEVICE_TO_HOST;
+                            success = true;
+                        }
+                        break;
+
+                    default:
+                        break;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Process class-specific requests
+
+    if (transfer->setup.bmRequestType.Type == CLASS_TYPE)
+    {
+        switch (transfer->setup.bRequest)
+        {
+            case SET_REPORT:
+                // First byte will be used for report ID
+                outputReport.data[0] = transfer->setup.wValue & 0xff;
+                outputReport.length = 0;
+
+                if (transfer->setup.wLength > sizeof(outputReport.data) - 1)
+                {
+                    break;
+                }
+                transfer->remaining = transfer->setup.wLength;
+                transfer->ptr = &outputReport.data[1];
+                transfer->direction = HOST_TO_DEVICE;
+                transfer->notify = true;
+                success = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return success;
+}
+
+// Called in ISR context
+// Data of SET_REPORT (one packet, up to MAX_PACKET_SIZE_EP0)
+void USBHIDFunction::requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length) {
+    if ((transfer->setup.bmRequestType.Type != CLASS_TYPE) \
+        || (transfer->setup.bRequest != SET_REPORT) \
+        || (length > sizeof(outputReport.data) - 1))
+    {
+        return;
+    }
+
+    memcpy(&outputReport.data[1], buf, length);
+    outputReport.length = length + 1;
+    HID_callbackSetReport(&outputReport);
+}
+
+
+// Called in ISR context
+bool USBHIDFunction::setConfiguration(void) {
+    // Configure endpoints > 0 (fails when they do not fit in USB RAM)
+    if (!device->addEndpoint(endpointIn(0), MAX_PACKET_SIZE_EPINT)
+        || !device->addEndpoint(endpointOut(0), MAX_PACKET_SIZE_EPINT))
+    {
+        return false;
+    }
+
+    // We activate the endpoint to be able to recceive data
+    device->readStart(endpointOut(0), MAX_PACKET_SIZE_EPINT);
+    return true;
+}
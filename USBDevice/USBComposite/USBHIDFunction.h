@@ -0,0 +1,94 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef USBHIDFUNCTION_H
+#define USBHIDFUNCTION_H
+
+#include "USBComposite.h"
+#include "USBHID_Types.h"
+
+/**
+ * HID interface of a USBComposite device: one interface with an interrupt
+ * IN and OUT endpoint, like USBHID.
+ *
+ * Derived classes give the report descriptor (reportDesc()) and handle
+ * reports on endpointCallback(endpointIn(0) / endpointOut(0)).
+ */
+class USBHIDFunction: public USBFunction {
+public:
+
+    /**
+    * Constructor
+    *
+    * @param subclass bInterfaceSubClass (HID_SUBCLASS_NONE / HID_SUBCLASS_BOOT)
+    * @param protocol bInterfaceProtocol (HID_PROTOCOL_NONE / _KEYBOARD / _MOUSE)
+    * @param interval bInterval of the endpoints (ms)
+    */
+    USBHIDFunction(uint8_t subclass = HID_SUBCLASS_NONE, uint8_t protocol = HID_PROTOCOL_NONE, uint8_t interval = 1);
+
+    /**
+    * Send a Report and return at once. warning: non blocking
+    *
+    * Completion: endpointCallback() of the IN endpoint
+    *
+    * @param report Report which will be sent (copied, may be reused at once)
+    * @returns true if the transfer was started
+    */
+    bool sendAsync(HID_REPORT *report);
+
+    virtual uint16_t descriptorLength();
+    virtual void writeDescriptors(uint8_t * buffer);
+    virtual bool request(CONTROL_TRANSFER * transfer);
+    virtual void requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length);
+    virtual bool setConfiguration(void);
+
+protected:
+    uint16_t reportLength;
+
+    /*
+    * Get the Report descriptor (sets reportLength)
+    *
+    * @returns pointer to the report descriptor
+    */
+    virtual uint8_t * reportDesc() = 0;
+
+    /*
+    * Get the length of the report descriptor
+    *
+    * @returns the length of the report descriptor
+    */
+    uint16_t reportDescLength();
+
+    /*
+    * HID Report received by SET_REPORT request. Warning: Called in ISR context
+    * First byte of data will be the report ID
+    *
+    * @param report Data and length received
+    */
+    virtual void HID_callbackSetReport(HID_REPORT *report){};
+
+private:
+    HID_REPORT outputReport;
+    uint8_t subclass;
+    uint8_t protocol;
+    uint8_t interval;
+    /* HID descriptor in the configuration descriptor */
+    uint8_t * hidDescriptor;
+};
+
+#endif
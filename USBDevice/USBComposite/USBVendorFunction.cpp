@@ -0,0 +1,125 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "stdint.h"
+#include "USBVendorFunction.h"
+
+#define VENDOR_CLASS (0xFF)
+
+#define TOTAL_DESCRIPTOR_LENGTH ((1 * INTERFACE_DESCRIPTOR_LENGTH) \
+                               + (2 * ENDPOINT_DESCRIPTOR_LENGTH))
+
+
+USBVendorFunction::USBVendorFunction(uint8_t subclass, uint8_t protocol): USBFunction(1, 1)
+{
+    this->subclass = subclass;
+    this->protocol = protocol;
+}
+
+bool USBVendorFunction::sendAsync(uint8_t * buffer, uint32_t size)
+{
+    return device->writeAsync(endpointIn(0), buffer, size, MAX_PACKET_SIZE_EPBULK);
+}
+
+
+uint16_t USBVendorFunction::descriptorLength() {
+    return TOTAL_DESCRIPTOR_LENGTH;
+}
+
+void USBVendorFunction::writeDescriptors(uint8_t * buffer) {
+    const uint8_t in = PHY_TO_DESC(endpointIn(0));
+    const uint8_t out = PHY_TO_DESC(endpointOut(0));
+
+    uint8_t descriptors[] = {
+        INTERFACE_DESCRIPTOR_LENGTH,        // bLength
+        INTERFACE_DESCRIPTOR,               // bDescriptorType
+        firstInterface(),                   // bInterfaceNumber
+        0x00,                               // bAlternateSetting
+        0x02,                               // bNumEndpoints
+        VENDOR_CLASS,                       // bInterfaceClass
+        subclass,                           // bInterfaceSubClass
+        protocol,                           // bInterfaceProtocol
+        0x00,                               // iInterface
+
+        ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
+        ENDPOINT_DESCRIPTOR,                // bDescriptorType
+        in,                                 // bEndpointAddress
+        E_BULK,                             // bmAttributes
+        LSB(MAX_PACKET_SIZE_EPBULK),        // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPBULK),        // wMaxPacketSize (MSB)
+        0,                                  // bInterval
+
+        ENDPOINT_DESCRIPTOR_LENGTH,         // bLength
+        ENDPOINT_DESCRIPTOR,                // bDescriptorType
+        out,                                // bEndpointAddress
+        E_BULK,                             // bmAttributes
+        LSB(MAX_PACKET_SIZE_EPBULK),        // wMaxPacketSize (LSB)
+        MSB(MAX_PACKET_SIZE_EPBULK),        // wMaxPacketSize (MSB)
+        0,                                  // bInterval
+    };
+    memcpy(buffer, descriptors, sizeof(descriptors));
+}
+
+
+// Called in ISR context
+// Device recipient requests are offered to every function, so only
+// requests addressed to this interface are taken
+bool USBVendorFunction::request(CONTROL_TRANSFER * transfer) {
+    if ((transfer->setup.bmRequestType.Type != VENDOR_TYPE) \
+        || (transfer->setup.bmRequestType.Recipient != INTERFACE_RECIPIENT))
+    {
+        return false;
+    }
+    return vendorRequest(transfer);
+}
+
+// Called in ISR context
+void USBVendorFunction::requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length) {
+    vendorRequestCompleted(transfer, buf, length);
+}
+
+// Called in ISR context
+bool USBVendorFunction::setConfiguration(void) {
+    // Configure endpoints > 0 (fails when they do not fit in USB RAM)
+    if (!device->addEndpoint(endpointIn(0), MAX_PACKET_SIZE_EPBULK)
+        || !device->addEndpoint(endpointOut(0), MAX_PACKET_SIZE_EPBULK))
+    {
+        return false;
+    }
+
+    // We activate the endpoint to be able to recceive data
+    device->readStart(endpointOut(0), MAX_PACKET_SIZE_EPBULK);
+    return true;
+}
+
+// Called in ISR context
+bool USBVendorFunction::endpointCallback(uint8_t endpoint) {
+    if (endpoint != endpointOut(0)) {
+        sent();
+        return true;
+    }
+
+    uint8_t buf[MAX_PACKET_SIZE_EPBULK];
+    uint32_t size = 0;
+    device->readEP(endpointOut(0), buf, &size, MAX_PACKET_SIZE_EPBULK);
+    received(buf, size);
+
+    // We reactivate the endpoint to receive next packet
+    device->readStart(endpointOut(0), MAX_PACKET_SIZE_EPBULK);
+    return true;
+}
@@ -0,0 +1,79 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef USBVENDORFUNCTION_H
+#define USBVENDORFUNCTION_H
+
+#include "USBComposite.h"
+
+/**
+ * Vendor specific interface (class 0xFF) of a USBComposite device with a
+ * bulk IN and OUT endpoint, for host tools talking through libusb / WinUSB.
+ *
+ * Derived classes get vendor requests addressed to the interface
+ * (vendorRequest()) and received packets (received()), both in ISR context.
+ */
+class USBVendorFunction: public USBFunction {
+public:
+    USBVendorFunction(uint8_t subclass = 0x00, uint8_t protocol = 0x00);
+
+    /*
+    * Send a packet and return at once. warning: non blocking
+    *
+    * @param buffer data (copied, may be reused at once)
+    * @param size up to MAX_PACKET_SIZE_EPBULK
+    * @returns true if the transfer was started (sent() on completion)
+    */
+    bool sendAsync(uint8_t * buffer, uint32_t size);
+
+    virtual uint16_t descriptorLength();
+    virtual void writeDescriptors(uint8_t * buffer);
+    virtual bool request(CONTROL_TRANSFER * transfer);
+    virtual void requestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length);
+    virtual bool setConfiguration(void);
+    virtual bool endpointCallback(uint8_t endpoint);
+
+protected:
+    /*
+    * Vendor request (recipient interface). Same as USBDevice::USBCallback_request()
+    *
+    * @returns true if handled
+    */
+    virtual bool vendorRequest(CONTROL_TRANSFER * transfer) { return false; };
+
+    /*
+    * Data stage of a vendor request taken with transfer->notify set
+    */
+    virtual void vendorRequestCompleted(CONTROL_TRANSFER * transfer, uint8_t * buf, uint32_t length) {};
+
+    /*
+    * Packet received on the bulk OUT endpoint
+    */
+    virtual void received(uint8_t * buf, uint32_t length) {};
+
+    /*
+    * The host took a packet of sendAsync(), in the order they were sent
+    */
+    virtual void sent() {};
+
+private:
+    uint8_t subclass;
+    uint8_t protocol;
+};
+
+#endif
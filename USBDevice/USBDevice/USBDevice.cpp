@@ -677,6 +677,7 @@ void USBDevice::busReset(void)
     device.state = DEFAULT;
     device.configuration = 0;
     device.suspended = false;
+    writePending = 0;
 
     /* Call class / vendor specific busReset function */
     USBCallback_busReset();
@@ -826,6 +827,7 @@ USBDevice::USBDevice(uint16_t vendor_id, uint16_t product_id, uint16_t product_r
     device.state = POWERED;
     device.configuration = 0;
     device.suspended = false;
+    writePending = 0;
 };
 
 
@@ -845,14 +847,8 @@ bool USBDevice::write(uint8_t endpoint, uint8_t * buffer, uint32_t size, uint32_
     }
 
 
-    if(!configured()) {
-        return false;
-    }
-
     /* Send report */
-    result = endpointWrite(endpoint, buffer, size);
-
-    if (result != EP_PENDING)
+    if (!writeAsync(endpoint, buffer, size, maxSize))
     {
         return false;
     }
@@ -862,6 +858,11 @@ bool USBDevice::write(uint8_t endpoint, uint8_t * buffer, uint32_t size, uint32_
         result = endpointWriteResult(endpoint);
     } while ((result == EP_PENDING) && configured());
 
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    writePending &= ~(1UL << endpoint);
+    __set_PRIMASK(primask);
+
     return (result == EP_COMPLETED);
 }
 
@@ -894,6 +895,78 @@ bool USBDevice::writeNB(uint8_t endpoint, uint8_t * buffer, uint32_t size, uint3
 
 
 
+bool USBDevice::writeAsync(uint8_t endpoint, uint8_t * buffer, uint32_t size, uint32_t maxSize)
+{
+    if (size > maxSize)
+    {
+        return false;
+    }
+
+    if(!configured()) {
+        return false;
+    }
+
+    /* Completion may come as soon as endpointWrite() armed the endpoint */
+    uint32_t mask = 1UL << endpoint;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool busy = writePending & mask;
+    writePending |= mask;
+    __set_PRIMASK(primask);
+
+    if (endpointWrite(endpoint, buffer, size) != EP_PENDING)
+    {
+        /* Still busy with a buffer written before */
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (!busy || (endpointWriteResult(endpoint) != EP_PENDING))
+        {
+            writePending &= ~mask;
+        }
+        __set_PRIMASK(primask);
+        return false;
+    }
+
+    return true;
+}
+
+
+void USBDevice::attachWriteCallback(uint8_t endpoint, Callback<void()> callback)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    writeCallback[endpoint] = callback;
+    __set_PRIMASK(primask);
+}
+
+
+bool USBDevice::writeBusy(uint8_t endpoint)
+{
+    return writePending & (1UL << endpoint);
+}
+
+
+void USBDevice::endpointCompleted(uint8_t endpoint)
+{
+    /* Called in ISR context */
+    uint32_t mask = 1UL << endpoint;
+    if (!(writePending & mask))
+    {
+        return;
+    }
+    /* Double buffered: busy until the staged packet is sent too */
+    if (endpointWriteResult(endpoint) != EP_PENDING)
+    {
+        writePending &= ~mask;
+    }
+
+    if (writeCallback[endpoint])
+    {
+        writeCallback[endpoint].call();
+    }
+}
+
+
 bool USBDevice::readEP(uint8_t endpoint, uint8_t * buffer, uint32_t * size, uint32_t maxSize)
 {
     EP_STATUS result;
@@ -22,6 +22,7 @@
 #include "mbed.h"
 #include "USBDevice_Types.h"
 #include "USBHAL.h"
+#include "Callback.h"
 
 class USBDevice: public USBHAL
 {
@@ -118,6 +119,41 @@ public:
     */
     bool writeNB(uint8_t endpoint, uint8_t * buffer, uint32_t size, uint32_t maxSize);
 
+    /*
+    * Start a write and return without waiting for the host.
+    * buffer is copied to the endpoint buffer. A double buffered endpoint
+    * (LPC11U) accepts a second write while the first one is in flight.
+    * Completion is reported by the callback of attachWriteCallback()
+    * and EPx_IN_callback().
+    *
+    * Warning: non blocking
+    *
+    * @param endpoint endpoint to write
+    * @param buffer data contained in buffer will be write
+    * @param size the number of bytes to write
+    * @param maxSize the maximum length that can be written on this endpoint
+    * @returns true if the transfer was started
+    */
+    bool writeAsync(uint8_t endpoint, uint8_t * buffer, uint32_t size, uint32_t maxSize);
+
+    /*
+    * Set the callback of endpoint, called in ISR context each time the
+    * host took a buffer of writeAsync() (before EPx_IN_callback).
+    * Buffers complete in the order they were written.
+    *
+    * @param endpoint endpoint of the writes
+    * @param callback called on completion (empty to detach)
+    */
+    void attachWriteCallback(uint8_t endpoint, Callback<void()> callback);
+
+    /*
+    * Check if a writeAsync() of endpoint is not completed yet
+    *
+    * @param endpoint endpoint to check
+    * @returns true while the host did not take the data
+    */
+    bool writeBusy(uint8_t endpoint);
+
 
     /*
     * Called by USBDevice layer on bus reset. Warning: Called in ISR context
@@ -236,6 +272,7 @@ protected:
     virtual void EP0in(void);
     virtual void connectStateChanged(unsigned int connected);
     virtual void suspendStateChanged(unsigned int suspended);
+    virtual void endpointCompleted(uint8_t endpoint);
     uint8_t * findDescriptor(uint8_t descriptorType);
     CONTROL_TRANSFER * getTransferPtr(void);
 
@@ -265,6 +302,10 @@ private:
 
     uint16_t currentInterface;
     uint8_t currentAlternate;
+
+    /* writeAsync() in progress (bit per physical endpoint) and endpoint callbacks */
+    volatile uint32_t writePending;
+    Callback<void()> writeCallback[NUMBER_OF_PHYSICAL_ENDPOINTS];
 };
 
 
@@ -53,6 +53,25 @@ public:
     EP_STATUS endpointReadResult(uint8_t endpoint, uint8_t *data, uint32_t *bytesRead);
     EP_STATUS endpointWrite(uint8_t endpoint, uint8_t *data, uint32_t size);
     EP_STATUS endpointWriteResult(uint8_t endpoint);
+#if defined(TARGET_LPC11UXX) || defined(TARGET_LPC11U6X) || defined(TARGET_LPC1347) || defined(TARGET_LPC1549)
+    /* Zero-copy write (LPC11U): build the packet in the USB RAM buffer */
+    /* returned by endpointWriteBuffer() (NULL while busy or stalled) and */
+    /* start it by endpointWriteBuffered() */
+    uint8_t * endpointWriteBuffer(uint8_t endpoint);
+    EP_STATUS endpointWriteBuffered(uint8_t endpoint, uint32_t size);
+
+    /* USB RAM for endpoint buffers (LPC11U), in bytes */
+    typedef struct {
+        uint32_t size;
+        uint32_t used;
+        uint32_t peak;
+        uint32_t padding;   /* lost to buffer alignment */
+        uint32_t failed;    /* realiseEndpoint() calls refused for lack of USB RAM */
+    } USB_RAM_USAGE;
+    static void usbRamUsage(USB_RAM_USAGE *usage);
+    /* Address of buffer (0/1) of endpoint in USB RAM, 0 when not allocated */
+    static uint32_t endpointBufferAddress(uint8_t endpoint, uint8_t buffer);
+#endif
     void stallEndpoint(uint8_t endpoint);
     void unstallEndpoint(uint8_t endpoint);
     bool realiseEndpoint(uint8_t endpoint, uint32_t maxPacket, uint32_t options);
@@ -67,6 +86,12 @@ protected:
     virtual void connectStateChanged(unsigned int connected){};
     virtual void suspendStateChanged(unsigned int suspended){};
     virtual void SOF(int frameNumber){};
+    /*
+    * A transfer of endpoint (physical, > EP0) was completed, before
+    * EPx_IN/OUT_callback. Called in ISR context by HALs which support it
+    * (LPC11U)
+    */
+    virtual void endpointCompleted(uint8_t endpoint){};
 
 #if defined(TARGET_NUMAKER_PFM_NUC472) || defined(TARGET_NUMAKER_PFM_M453)
     // NUC472/M453 USB doesn't support configuration of the same EP number for IN/OUT simultaneously.
@@ -41,6 +41,11 @@ bool USBHID::sendNB(HID_REPORT *report)
     return writeNB(EPINT_IN, report->data, report->length, MAX_HID_REPORT_SIZE);
 }
 
+bool USBHID::sendAsync(HID_REPORT *report)
+{
+    return writeAsync(EPINT_IN, report->data, report->length, MAX_HID_REPORT_SIZE);
+}
+
 
 bool USBHID::read(HID_REPORT *report)
 {
@@ -167,9 +172,12 @@ bool USBHID::USBCallback_setConfiguration(uint8_t configuration) {
         return false;
     }
 
-    // Configure endpoints > 0
-    addEndpoint(EPINT_IN, MAX_PACKET_SIZE_EPINT);
-    addEndpoint(EPINT_OUT, MAX_PACKET_SIZE_EPINT);
+    // Configure endpoints > 0 (fails when they do not fit in USB RAM)
+    if (!addEndpoint(EPINT_IN, MAX_PACKET_SIZE_EPINT)
+        || !addEndpoint(EPINT_OUT, MAX_PACKET_SIZE_EPINT))
+    {
+        return false;
+    }
 
     // We activate the endpoint to be able to recceive data
     readStart(EPINT_OUT, MAX_PACKET_SIZE_EPINT);
@@ -80,6 +80,16 @@ public:
     */
     bool sendNB(HID_REPORT *report);
 
+    /**
+    * Send a Report and return at once. warning: non blocking
+    *
+    * Completion: attachWriteCallback(EPINT_IN, ...) or EPINT_IN_callback()
+    *
+    * @param report Report which will be sent (copied, may be reused at once)
+    * @returns true if the transfer was started
+    */
+    bool sendAsync(HID_REPORT *report);
+
     /**
     * Read a report: blocking
     *
@@ -42,6 +42,12 @@
 #define GET_IDLE   (0x2)
 #define SET_REPORT (0x9)
 #define SET_IDLE   (0xa)
+#define GET_PROTOCOL (0x3)
+#define SET_PROTOCOL (0xb)
+
+/* GET_PROTOCOL / SET_PROTOCOL wValue */
+#define HID_BOOT_PROTOCOL   (0)
+#define HID_REPORT_PROTOCOL (1)
 
 /* HID Class Report Descriptor */
 /* Short items: size is 0, 1, 2 or 3 specifying 0, 1, 2 or 4 (four) bytes */
@@ -53,6 +53,50 @@ public:
         return(!empty);
     };
 
+    /*
+     * In-place access for large elements. Unlike queue(), nothing is dropped
+     * when full, so one producer and one consumer (e.g. ISR) can share the
+     * buffer: the producer only moves write, the consumer only moves read.
+     */
+
+    // slot to be filled before commit(), NULL when full
+    T * reserve() {
+        return isFull() ? NULL : &buf[write];
+    }
+
+    void commit() {
+        write = (write + 1) % size;
+    }
+
+    // oldest element (not removed), NULL when empty
+    T * peek() {
+        return isEmpty() ? NULL : &buf[read];
+    }
+
+    // newest element, NULL when empty
+    T * last() {
+        return isEmpty() ? NULL : &buf[(write + size - 1) % size];
+    }
+
+    // n-th element from the oldest, NULL when n >= available()
+    T * at(uint16_t n) {
+        return n < available() ? &buf[(read + n) % size] : NULL;
+    }
+
+    // remove oldest element
+    void drop() {
+        if (!isEmpty()) {
+            read = (read + 1) % size;
+        }
+    }
+
+    // remove newest element (producer side)
+    void dropLast() {
+        if (!isEmpty()) {
+            write = (write + size - 1) % size;
+        }
+    }
+
 private:
     volatile uint16_t write;
     volatile uint16_t read;
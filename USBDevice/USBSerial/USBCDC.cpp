@@ -113,10 +113,13 @@ bool USBCDC::USBCallback_setConfiguration(uint8_t configuration) {
         return false;
     }
 
-    // Configure endpoints > 0
-    addEndpoint(EPINT_IN, MAX_PACKET_SIZE_EPINT);
-    addEndpoint(EPBULK_IN, MAX_PACKET_SIZE_EPBULK);
-    addEndpoint(EPBULK_OUT, MAX_PACKET_SIZE_EPBULK);
+    // Configure endpoints > 0 (fails when they do not fit in USB RAM)
+    if (!addEndpoint(EPINT_IN, MAX_PACKET_SIZE_EPINT)
+        || !addEndpoint(EPBULK_IN, MAX_PACKET_SIZE_EPBULK)
+        || !addEndpoint(EPBULK_OUT, MAX_PACKET_SIZE_EPBULK))
+    {
+        return false;
+    }
 
     // We activate the endpoint to be able to recceive data
     readStart(EPBULK_OUT, MAX_PACKET_SIZE_EPBULK);
@@ -124,7 +127,17 @@ bool USBCDC::USBCallback_setConfiguration(uint8_t configuration) {
 }
 
 bool USBCDC::send(uint8_t * buffer, uint32_t size) {
-    return USBDevice::write(EPBULK_IN, buffer, size, MAX_CDC_REPORT_SIZE);
+    if (size > MAX_CDC_REPORT_SIZE) {
+        return false;
+    }
+    // wait for a free buffer only: the packet is staged while the previous
+    // one is sent (double buffered EPBULK_IN)
+    while (!writeAsync(EPBULK_IN, buffer, size, MAX_CDC_REPORT_SIZE)) {
+        if (!configured() || getEndpointStallState(EPBULK_IN)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool USBCDC::readEP(uint8_t * buffer, uint32_t * size) {
@@ -75,7 +75,8 @@ protected:
     * @param endpoint endpoint which will be sent the buffer
     * @param buffer buffer to be sent
     * @param size length of the buffer
-    * @returns true if successful
+    * @returns true if the packet was queued on the endpoint (it may be
+    *          still in flight, buffer can be reused at once)
     */
     bool send(uint8_t * buffer, uint32_t size);
 
@@ -25,6 +25,7 @@
 #endif
 
 #include "USBHAL.h"
+#include "USBMemCopy_LPC11U.h"
 
 USBHAL * USBHAL::instance;
 #if defined(TARGET_LPC1549)
@@ -96,6 +97,11 @@ static uint8_t usbmem[2048] __attribute__((aligned(2048)));
 
 static volatile int epComplete = 0;
 
+// Double buffered IN endpoints: buffer (bit set: 1) endpointWrite() fills
+// next. The hardware sends buffers alternately starting at EPINUSE, so
+// software keeps its own index to stage a packet while the other is sent.
+static volatile uint32_t epNextBuffer = 0;
+
 // One entry for a double-buffered logical endpoint in the endpoint
 // command/status list. Endpoint 0 is single buffered, out[1] is used
 // for the SETUP packet and in[1] is not used
@@ -128,21 +134,55 @@ static CONTROL_TRANSFER *ct = NULL;
 // initiating a remote wakeup event.
 static volatile uint32_t devCmdStat;
 
-// Pointers used to allocate USB RAM
+// Pointer used to allocate USB RAM for command/status list and EP0
 static uint32_t usbRamPtr = USB_RAM_START;
-static uint32_t epRamPtr = 0; // Buffers for endpoints > 0 start here
 
 #define ROUND_UP_TO_MULTIPLE(x, m) ((((x)+((m)-1))/(m))*(m))
 
-void USBMemCopy(uint8_t *dst, uint8_t *src, uint32_t size);
-void USBMemCopy(uint8_t *dst, uint8_t *src, uint32_t size) {
-    if (size > 0) {
-        do {
-            *dst++ = *src++;
-        } while (--size > 0);
-    }
+// Command/status list (256 byte aligned) and EP0 (64 byte aligned) must fit
+typedef char USB_RAM_FIXED_AREA_CHECK[
+    (ROUND_UP_TO_MULTIPLE(sizeof(EP_COMMAND_STATUS) * NUMBER_OF_LOGICAL_ENDPOINTS, 64)
+     + sizeof(CONTROL_TRANSFER) + 256 <= USB_RAM_SIZE) ? 1 : -1];
+
+// Arena for buffers of endpoints > 0, after EP0. Buffers are 64 byte
+// aligned blocks (CMDSTS_ADDRESS_OFFSET). Reset by disableEndpoints() on
+// bus reset; an endpoint realised again (SET_CONFIGURATION) keeps its
+// buffers when they are large enough, so nothing leaks in between.
+static struct {
+    uint32_t start;
+    uint32_t next;
+    uint32_t peak;
+    uint32_t padding;   // bytes lost to 64 byte alignment
+    uint32_t failed;    // endpoints refused, they did not fit
+} usbRamArena;
+
+// Per endpoint: size of each buffer (0: none) and number of buffers
+static uint16_t epBufferSize[NUMBER_OF_PHYSICAL_ENDPOINTS];
+static uint8_t epBufferCount[NUMBER_OF_PHYSICAL_ENDPOINTS];
+
+static void usbRamReset(void) {
+    usbRamArena.next = usbRamArena.start;
+    usbRamArena.padding = 0;
+    memset(epBufferSize, 0, sizeof(epBufferSize));
+    memset(epBufferCount, 0, sizeof(epBufferCount));
 }
 
+// Returns 0 when size does not fit
+static uint32_t usbRamAlloc(uint32_t size) {
+    uint32_t block = ROUND_UP_TO_MULTIPLE(size, 64);
+    uint32_t address = usbRamArena.next;
+
+    if (address + block > USB_RAM_START + USB_RAM_SIZE) {
+        return 0;
+    }
+
+    usbRamArena.next += block;
+    usbRamArena.padding += block - size;
+    if (usbRamArena.next - usbRamArena.start > usbRamArena.peak) {
+        usbRamArena.peak = usbRamArena.next - usbRamArena.start;
+    }
+    return address;
+}
 
 USBHAL::USBHAL(void) {
     NVIC_DisableIRQ(USB_IRQ);
@@ -220,6 +260,10 @@ USBHAL::USBHAL(void) {
     usbRamPtr += sizeof(CONTROL_TRANSFER);
     LPC_USB->DATABUFSTART =(uint32_t)(ct) & 0xffc00000;
 
+    // Endpoint buffers start here
+    usbRamArena.start = ROUND_UP_TO_MULTIPLE(usbRamPtr, 64);
+    usbRamReset();
+
     // Setup command/status list for EP0
     ep[0].out[0] = 0;
     ep[0].in[0] =  0;
@@ -386,10 +430,28 @@ void USBHAL::setAddress(uint8_t address) {
     LPC_USB->DEVCMDSTAT = devCmdStat;
 }
 
-EP_STATUS USBHAL::endpointWrite(uint8_t endpoint, uint8_t *data, uint32_t size) {
-    uint32_t flags = 0;
+static uint32_t nextWriteBuffer(uint8_t endpoint) {
     uint32_t bf;
 
+    if (LPC_USB->EPBUFCFG & EP(endpoint)) {
+        // Double buffered: fill the buffer after the last one written
+        // (may be staged while the other buffer is in flight)
+        if (epNextBuffer & EP(endpoint)) {
+            bf = 1;
+        } else {
+            bf = 0;
+        }
+    } else {
+        // Single buffered
+        bf = 0;
+    }
+
+    return bf;
+}
+
+EP_STATUS USBHAL::endpointWrite(uint8_t endpoint, uint8_t *data, uint32_t size) {
+    uint8_t *buffer;
+
     // Validate parameters
     if (data == NULL) {
         return EP_INVALID;
@@ -407,30 +469,55 @@ EP_STATUS USBHAL::endpointWrite(uint8_t endpoint, uint8_t *data, uint32_t size)
         return EP_INVALID;
     }
 
-    if (LPC_USB->EPBUFCFG & EP(endpoint)) {
-        // Double buffered
-        if (LPC_USB->EPINUSE & EP(endpoint)) {
-            bf = 1;
-        } else {
-            bf = 0;
+    buffer = endpointWriteBuffer(endpoint);
+    if (buffer == NULL) {
+        // Check if stalled, otherwise already active
+        if (ep[PHY_TO_LOG(endpoint)].in[nextWriteBuffer(endpoint)] & CMDSTS_S) {
+            return EP_STALLED;
         }
-    } else {
-        // Single buffered
-        bf = 0;
+        return EP_INVALID;
     }
 
-    // Check if already active
-    if (ep[PHY_TO_LOG(endpoint)].in[bf] & CMDSTS_A) {
+    // Copy data to USB RAM
+    USBMemCopy(buffer, data, size);
+
+    return endpointWriteBuffered(endpoint, size);
+}
+
+uint8_t * USBHAL::endpointWriteBuffer(uint8_t endpoint) {
+    uint32_t bf;
+
+    if (endpoint > LAST_PHYSICAL_ENDPOINT) {
+        return NULL;
+    }
+
+    if ((endpoint==EP0IN) || (endpoint==EP0OUT) || OUT_EP(endpoint)) {
+        return NULL;
+    }
+
+    bf = nextWriteBuffer(endpoint);
+
+    // Already active (both buffers in use) or stalled
+    if (ep[PHY_TO_LOG(endpoint)].in[bf] & (CMDSTS_A | CMDSTS_S)) {
+        return NULL;
+    }
+
+    return (uint8_t *)endpointState[endpoint].buffer[bf];
+}
+
+EP_STATUS USBHAL::endpointWriteBuffered(uint8_t endpoint, uint32_t size) {
+    uint32_t flags = 0;
+    uint32_t bf;
+
+    if (endpointWriteBuffer(endpoint) == NULL) {
         return EP_INVALID;
     }
 
-    // Check if stalled
-    if (ep[PHY_TO_LOG(endpoint)].in[bf] & CMDSTS_S) {
-        return EP_STALLED;
+    if (size > endpointState[endpoint].maxPacket) {
+        return EP_INVALID;
     }
 
-    // Copy data to USB RAM
-    USBMemCopy((uint8_t *)endpointState[endpoint].buffer[bf], data, size);
+    bf = nextWriteBuffer(endpoint);
 
     // Add options
     if (endpointState[endpoint].options & RATE_FEEDBACK_MODE) {
@@ -446,11 +533,15 @@ EP_STATUS USBHAL::endpointWrite(uint8_t endpoint, uint8_t *data, uint32_t size)
                                       endpointState[endpoint].buffer[bf]) \
                                       | CMDSTS_NBYTES(size) | CMDSTS_A | flags;
 
+    if (LPC_USB->EPBUFCFG & EP(endpoint)) {
+        epNextBuffer ^= EP(endpoint);
+    }
+
     return EP_PENDING;
 }
 
 EP_STATUS USBHAL::endpointWriteResult(uint8_t endpoint) {
-    uint32_t bf;
+    uint32_t status;
 
     // Validate parameters
     if (endpoint > LAST_PHYSICAL_ENDPOINT) {
@@ -461,25 +552,19 @@ EP_STATUS USBHAL::endpointWriteResult(uint8_t endpoint) {
         return EP_INVALID;
     }
 
+    status = ep[PHY_TO_LOG(endpoint)].in[0];
     if (LPC_USB->EPBUFCFG & EP(endpoint)) {
-        // Double buffered     // TODO: FIX THIS
-        if (LPC_USB->EPINUSE & EP(endpoint)) {
-            bf = 1;
-        } else {
-            bf = 0;
-        }
-    } else {
-        // Single buffered
-        bf = 0;
+        // Double buffered: completed when both buffers are sent
+        status |= ep[PHY_TO_LOG(endpoint)].in[1];
     }
 
     // Check if endpoint still active
-    if (ep[PHY_TO_LOG(endpoint)].in[bf] & CMDSTS_A) {
+    if (status & CMDSTS_A) {
         return EP_PENDING;
     }
 
     // Check if stalled
-    if (ep[PHY_TO_LOG(endpoint)].in[bf] & CMDSTS_S) {
+    if (status & CMDSTS_S) {
         return EP_STALLED;
     }
 
@@ -507,8 +592,10 @@ void USBHAL::unstallEndpoint(uint8_t endpoint) {
 
             if (LPC_USB->EPINUSE & EP(endpoint)) {
                 ep[PHY_TO_LOG(endpoint)].in[1] = CMDSTS_TR; // S = 0, TR = 1, TV = 0
+                epNextBuffer |= EP(endpoint);
             } else {
                 ep[PHY_TO_LOG(endpoint)].in[0] = CMDSTS_TR; // S = 0, TR = 1, TV = 0
+                epNextBuffer &= ~EP(endpoint);
             }
         } else {
             ep[PHY_TO_LOG(endpoint)].out[0] = 0; // S = 0
@@ -557,7 +644,8 @@ bool USBHAL::getEndpointStallState(unsigned char endpoint) {
 }
 
 bool USBHAL::realiseEndpoint(uint8_t endpoint, uint32_t maxPacket, uint32_t options) {
-    uint32_t tmpEpRamPtr;
+    uint32_t buffers = (options & SINGLE_BUFFERED) ? 1 : 2;
+    uint32_t bf;
 
     if (endpoint > LAST_PHYSICAL_ENDPOINT) {
         return false;
@@ -568,38 +656,27 @@ bool USBHAL::realiseEndpoint(uint8_t endpoint, uint32_t maxPacket, uint32_t opti
         return false;
     }
 
-    // Allocate buffers in USB RAM
-    tmpEpRamPtr = epRamPtr;
-
-    // Must be 64 byte aligned
-    tmpEpRamPtr = ROUND_UP_TO_MULTIPLE(tmpEpRamPtr, 64);
-
-    if ((tmpEpRamPtr + maxPacket) > (USB_RAM_START + USB_RAM_SIZE)) {
-        // Out of memory
-        return false;
-    }
-
-    // Allocate first buffer
-    endpointState[endpoint].buffer[0] = tmpEpRamPtr;
-    tmpEpRamPtr += maxPacket;
-
-    if (!(options & SINGLE_BUFFERED)) {
-        // Must be 64 byte aligned
-        tmpEpRamPtr = ROUND_UP_TO_MULTIPLE(tmpEpRamPtr, 64);
-
-        if ((tmpEpRamPtr + maxPacket) > (USB_RAM_START + USB_RAM_SIZE)) {
-            // Out of memory
-            return false;
+    // Allocate buffers in USB RAM (kept when realised again)
+    if ((epBufferSize[endpoint] < maxPacket) || (epBufferCount[endpoint] < buffers)) {
+        uint32_t next = usbRamArena.next;
+        uint32_t padding = usbRamArena.padding;
+        for (bf = 0; bf < buffers; bf++) {
+            endpointState[endpoint].buffer[bf] = usbRamAlloc(maxPacket);
+            if (endpointState[endpoint].buffer[bf] == 0) {
+                // Out of memory: called from SET_CONFIGURATION in the USB
+                // ISR, so fail the request instead of halting
+                usbRamArena.next = next;
+                usbRamArena.padding = padding;
+                usbRamArena.failed++;
+                epBufferSize[endpoint] = 0;
+                epBufferCount[endpoint] = 0;
+                return false;
+            }
         }
-
-        // Allocate second buffer
-        endpointState[endpoint].buffer[1] = tmpEpRamPtr;
-        tmpEpRamPtr += maxPacket;
+        epBufferSize[endpoint] = maxPacket;
+        epBufferCount[endpoint] = buffers;
     }
 
-    // Commit to this USB RAM allocation
-    epRamPtr = tmpEpRamPtr;
-
     // Remaining endpoint state values
     endpointState[endpoint].maxPacket = maxPacket;
     endpointState[endpoint].options = options;
@@ -641,8 +718,23 @@ static void disableEndpoints(void) {
         ep[logEp].in[1] =  CMDSTS_D;
     }
 
-    // Start of USB RAM for endpoints > 0
-    epRamPtr = usbRamPtr;
+    // Free USB RAM of endpoints > 0
+    usbRamReset();
+}
+
+void USBHAL::usbRamUsage(USB_RAM_USAGE *usage) {
+    usage->size = USB_RAM_START + USB_RAM_SIZE - usbRamArena.start;
+    usage->used = usbRamArena.next - usbRamArena.start;
+    usage->peak = usbRamArena.peak;
+    usage->padding = usbRamArena.padding;
+    usage->failed = usbRamArena.failed;
+}
+
+uint32_t USBHAL::endpointBufferAddress(uint8_t endpoint, uint8_t buffer) {
+    if ((endpoint > LAST_PHYSICAL_ENDPOINT) || (buffer >= epBufferCount[endpoint])) {
+        return 0;
+    }
+    return endpointState[endpoint].buffer[buffer];
 }
 
 
@@ -728,6 +820,7 @@ void USBHAL::usbisr(void) {
         if (LPC_USB->INTSTAT & EP(num)) {
             LPC_USB->INTSTAT = EP(num);
             epComplete |= EP(num);
+            endpointCompleted(num);
             if ((instance->*(epCallback[num - 2]))()) {
                 epComplete &= ~EP(num);
             }
@@ -0,0 +1,56 @@
+/* Copyright (c) 2010-2011 mbed.org, MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without
+* restriction, including without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or
+* substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef USBMEMCOPY_LPC11U_H
+#define USBMEMCOPY_LPC11U_H
+
+#include <stdint.h>
+
+// Copy to / from USB RAM (also built on the host by test/bench_usb_mem_copy.cpp)
+static inline void USBMemCopy(uint8_t *dst, uint8_t *src, uint32_t size) {
+    // Endpoint buffers in USB RAM are 64 byte aligned, so word copy is
+    // used whenever the other side is word aligned too (Cortex-M0 has no
+    // unaligned access). 4 words per loop become LDM/STM.
+    if ((((uintptr_t)dst | (uintptr_t)src) & 3) == 0) {
+        uint32_t *d = (uint32_t *)dst;
+        const uint32_t *s = (const uint32_t *)src;
+        while (size >= 16) {
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+            d[3] = s[3];
+            d += 4;
+            s += 4;
+            size -= 16;
+        }
+        while (size >= 4) {
+            *d++ = *s++;
+            size -= 4;
+        }
+        dst = (uint8_t *)d;
+        src = (uint8_t *)s;
+    }
+
+    // unaligned or tail
+    while (size > 0) {
+        *dst++ = *src++;
+        size--;
+    }
+}
+
+#endif
@@ -1,20 +1,83 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
-Serial serial(UART_TX, UART_RX);
+// UART, defined in main.cpp
+extern Serial serial;
 
 #define DEBUG 0
 #define DEBUG_KEYEVENT 0
 
+// report protocol sends N-key rollover bitmap (boot protocol is always 6KRO)
+#define NKRO_ENABLE 1
+
+// USB polling interval of the keyboard endpoints (bInterval, ms: 1-255)
+// 1 = 1000Hz. Full speed interrupt endpoints are polled at this rate by
+// Windows / macOS / Linux; queued reports drain one per poll.
+#define USB_POLLING_INTERVAL_MS 1
+
+// USB virtual serial port (CDC) next to the keyboard (composite device).
+// DEBUG_PRINTF / DEBUG_PRINTF_KEYEVENT go there instead of the UART,
+// without blocking; output is dropped while no terminal is open
+#define USB_CDC_CONSOLE 0
+
+// vendor specific interface (bulk IN / OUT, USBVendorFunction) next to the
+// keyboard, for host tools talking to the device through libusb / WinUSB
+#define USB_VENDOR_INTERFACE 0
+
+// reports waiting for EPINT_IN, one per key event (>= 3)
+#define REPORT_QUEUE_SIZE 8
+
+// scan matrix with interrupt driven I2C (I2CTransactionQueue)
+#define I2C_ASYNC 0
+
+// debounce algorithm (Debouncer.h)
+#define DEBOUNCE_FILTER 0  // press after 2 agreeing scans, release immediately
+#define DEBOUNCE_EAGER 1   // press immediately, release after DEBOUNCE_RELEASE_MS without contact
+#define DEBOUNCE_COUNTER 2 // either edge after 4 agreeing scans
+#define DEBOUNCE DEBOUNCE_FILTER
+#define DEBOUNCE_RELEASE_MS 5
+
+// scan scheduler (ScanScheduler.h)
+// fast while keys are active, slow after SCAN_SLOW_AFTER_MS idle,
+// MCP23017 interrupt only after SCAN_STOP_AFTER_MS idle
+// fast scan runs every SCAN_POLLS_PER_SCAN USB polls.
+// a full scan of 2 MCP23017 at 400kHz takes a few ms (DEBUG prints "scan time"), so 1 poll per scan
+// needs a faster matrix (GpioKeyboardMatrix)
+#define SCAN_POLLS_PER_SCAN 4
+#define SCAN_INTERVAL_FAST_US (USB_POLLING_INTERVAL_MS * SCAN_POLLS_PER_SCAN * 1000)
+#define SCAN_INTERVAL_SLOW_US 20000
+#define SCAN_SLOW_AFTER_MS 100
+#define SCAN_STOP_AFTER_MS 1000
+// start fast scans on USB SOF (start of frame) instead of the Ticker
+#define SCAN_SOF_SYNC 1
+// with SCAN_SOF_SYNC, start each scan so that it ends SCAN_SOF_MARGIN_US
+// before the host IN token (measured phase after SOF)
+#define SCAN_SOF_PHASE_LOCK 1
+#define SCAN_SOF_MARGIN_US 100
+
+// tap-hold keys (MT/LT in keymap.h, TapHold.h)
+#define TAPPING_TERM_MS 200
+// TapHold::PERMISSIVE_HOLD and/or TapHold::HOLD_ON_OTHER_KEY_PRESS
+#define TAP_HOLD_FLAGS TapHold::PERMISSIVE_HOLD
+
+#if USB_CDC_CONSOLE
+#include "USBCDCFunction.h"
+// defined in main.cpp
+extern USBCDCFunction console;
+#define DEBUG_OUT console
+#else
+#define DEBUG_OUT serial
+#endif
+
 #if DEBUG_KEYEVENT
-#define DEBUG_PRINTF_KEYEVENT(...) serial.printf(__VA_ARGS__)
+#define DEBUG_PRINTF_KEYEVENT(...) DEBUG_OUT.printf(__VA_ARGS__)
 #else
 #define DEBUG_PRINTF_KEYEVENT(...)
 #endif
 
 // Generic DEBUG_PRINTF must not used at any interrupt
 #if DEBUG
-#define DEBUG_PRINTF(...) serial.printf(__VA_ARGS__)
+#define DEBUG_PRINTF(...) DEBUG_OUT.printf(__VA_ARGS__)
 #else
 #define DEBUG_PRINTF(...)
 #endif
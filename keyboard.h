@@ -278,6 +278,27 @@
 #define MEDIAKEY_AUDIO_VOL_UP   0x05
 #define MEDIAKEY_AUDIO_VOL_DOWN 0x06
 
+// Consumer page (0x0C) usages for the Consumer Control report
+// (CONSUMER() in keymap.h)
+#define CONSUMER_NEXT_TRACK     0xB5
+#define CONSUMER_PREV_TRACK     0xB6
+#define CONSUMER_STOP           0xB7
+#define CONSUMER_PLAY_PAUSE     0xCD
+#define CONSUMER_MUTE           0xE2
+#define CONSUMER_VOLUME_UP      0xE9
+#define CONSUMER_VOLUME_DOWN    0xEA
+#define CONSUMER_AL_CALCULATOR  0x192
+#define CONSUMER_AC_SEARCH      0x221
+#define CONSUMER_AC_HOME        0x223
+#define CONSUMER_AC_BACK        0x224
+#define CONSUMER_AC_FORWARD     0x225
+
+// Generic Desktop usages for the System Control report
+// (SYSTEM() in keymap.h)
+#define SYSTEM_POWER_DOWN       0x81
+#define SYSTEM_SLEEP            0x82
+#define SYSTEM_WAKE_UP          0x83
+
 
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
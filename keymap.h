@@ -1,73 +1,283 @@
 #include "keyboard.h"
 #include "keyboard--short-names.h"
+#include "LayerStack.h"
+#include "TapHold.h"
 
-class Keymap;
-struct keyfunc_t {
-	int8_t row;
-	int8_t col;
-	void (*func)(Keymap& keymap, bool pressed);
-};
+/**
+ * Action of a key in KEYMAP_DEFINITION
+ *   0x00kk  HID key code kk (0: nothing)
+ *   0x01ll  MO(l)  layer l while held
+ *   0x02ll  TG(l)  toggle layer l
+ *   0x03ll  OSL(l) layer l for the next key press
+ *   0x04ll  DF(l)  set default layer to l
+ *   0x06uu  SYSTEM(u)    system control usage u (SYSTEM_SLEEP ...)
+ *   0x08uu-0x0Buu  CONSUMER(u)  Consumer page usage u (0x000-0x3FF, CONSUMER_PLAY_PAUSE ...)
+ *   0x1mkk  MT(mod, k)  modifier mod (_ctrlL.._guiR) when held, key code k when tapped
+ *   0x2lkk  LT(l, k)    layer l (0-15) when held, key code k when tapped
+ *   0xFFFF  _trans key of the next lower active layer
+ */
+typedef uint16_t keyaction_t;
+
+#define KEY_ACTION_KIND(action) ((action) >> 8)
+#define KEY_ACTION_ARG(action) ((action) & 0xff)
+#define KEY_ACTION_KEYCODE 0x00
+#define KEY_ACTION_MO 0x01
+#define KEY_ACTION_TG 0x02
+#define KEY_ACTION_OSL 0x03
+#define KEY_ACTION_DF 0x04
+#define KEY_ACTION_SYSTEM 0x06
+#define KEY_ACTION_CONSUMER 0x08
+#define KEY_ACTION_CONSUMER_MASK 0xFC
+#define KEY_ACTION_CONSUMER_USAGE(action) ((action) & 0x3FF)
+#define KEY_ACTION_MT 0x10
+#define KEY_ACTION_LT 0x20
+#define KEY_ACTION_TAP_HOLD_MASK 0xF0
+#define KEY_ACTION_TRANSPARENT 0xFFFF
 
+// layer >= LAYERS (defined below, checked where the macro is used) does not compile
+#define KEY_ACTION_LAYER(kind, layer) (((kind) << 8) | (layer) | 0 * sizeof(char[((layer) < LAYERS) ? 1 : -1]))
+#define MO(layer) KEY_ACTION_LAYER(KEY_ACTION_MO, layer)
+#define TG(layer) KEY_ACTION_LAYER(KEY_ACTION_TG, layer)
+#define OSL(layer) KEY_ACTION_LAYER(KEY_ACTION_OSL, layer)
+#define DF(layer) KEY_ACTION_LAYER(KEY_ACTION_DF, layer)
+// usage above 0x3FF (the report descriptor maximum) does not compile
+#define CONSUMER(usage) ((keyaction_t)((KEY_ACTION_CONSUMER << 8) | (usage) | 0 * sizeof(char[((usage) <= 0x3FF) ? 1 : -1])))
+#define SYSTEM(usage) ((KEY_ACTION_SYSTEM << 8) | (usage))
+#define MT(mod, key) (((KEY_ACTION_MT | ((mod) & 0x07)) << 8) | (key))
+#define LT(layer, key) (((KEY_ACTION_LT | ((layer) & 0x0F)) << 8) | (key))
 
 static const uint8_t ROWS = 8;
 static const uint8_t COLS = 16;
 static const uint8_t LAYERS = 2;
 
+typedef char KEYMAP_LAYERS_CHECK[(LAYERS <= LayerStack::MAX_LAYERS) ? 1 : -1];
+
 class Keymap {
-	static const uint8_t KEYMAP_DEFINITION[LAYERS][ROWS][COLS];
-	static const keyfunc_t KEYMAP_FUNCTIONS[];
+	static const keyaction_t KEYMAP_DEFINITION[LAYERS][ROWS][COLS];
 
-	int8_t layer;
+	LayerStack layers;
+	// action resolved on press. release uses this regardless of current layers
+	keyaction_t pressedActions[ROWS][COLS];
 	MyUSBKeyboard& keyboard;
-public:
 
-	Keymap(MyUSBKeyboard& _keyboard) : layer(0), keyboard(_keyboard) {
+	TapHold tapHold;
+	// key code of a tap, released on next tick() so that the host sees it
+	uint8_t tapRelease;
+	// time of current scan (ms)
+	uint32_t now;
+
+	static uint8_t tapHoldKind(const keyaction_t action) {
+		const uint8_t kind = KEY_ACTION_KIND(action) & KEY_ACTION_TAP_HOLD_MASK;
+		return (kind == KEY_ACTION_MT || kind == KEY_ACTION_LT) ? kind : 0;
 	}
 
-	static void switch_layer(Keymap& keymap, const bool pressed) {
-		if (pressed) {
-			keymap.layer++;
-			if (keymap.layer > LAYERS) {
-				keymap.layer = LAYERS - 1;
-			}
+	// CONSUMER spans kinds 0x08-0x0B
+	static uint8_t actionKind(const keyaction_t action) {
+		const uint8_t kind = KEY_ACTION_KIND(action);
+		return ((kind & KEY_ACTION_CONSUMER_MASK) == KEY_ACTION_CONSUMER) ? KEY_ACTION_CONSUMER : kind;
+	}
+
+	keyaction_t resolve(const int row, const int col) const {
+		for (int layer = LAYERS - 1; layer >= 0; layer--) {
+			if (!layers.isActive(layer)) continue;
+			const keyaction_t action = KEYMAP_DEFINITION[layer][row][col];
+			if (action != KEY_ACTION_TRANSPARENT) return action;
+		}
+		return 0;
+	}
+
+	void press(const keyaction_t action) {
+		const uint8_t arg = KEY_ACTION_ARG(action);
+		switch (actionKind(action)) {
+			case KEY_ACTION_KEYCODE:
+				if (arg) {
+					DEBUG_PRINTF_KEYEVENT("D%d %x\r\n", layers.highest(), arg);
+					keyboard.appendReportData(arg);
+				}
+				layers.keyPressed();
+				return;
+			case KEY_ACTION_MO:
+				layers.on(arg);
+				break;
+			case KEY_ACTION_TG:
+				layers.toggle(arg);
+				break;
+			case KEY_ACTION_OSL:
+				layers.oneShotPress(arg);
+				break;
+			case KEY_ACTION_DF:
+				layers.setDefault(arg);
+				break;
+			case KEY_ACTION_CONSUMER:
+				DEBUG_PRINTF_KEYEVENT("C %x\r\n", KEY_ACTION_CONSUMER_USAGE(action));
+				keyboard.appendConsumerData(KEY_ACTION_CONSUMER_USAGE(action));
+				layers.keyPressed();
+				return;
+			case KEY_ACTION_SYSTEM:
+				DEBUG_PRINTF_KEYEVENT("S %x\r\n", arg);
+				keyboard.appendSystemData(arg);
+				layers.keyPressed();
+				return;
+		}
+		DEBUG_PRINTF_KEYEVENT("LAYER->%x\r\n", layers.state());
+	}
+
+	void pressHold(const keyaction_t action) {
+		if (tapHoldKind(action) == KEY_ACTION_MT) {
+			keyboard.appendReportData(KEY_LeftControl | (KEY_ACTION_KIND(action) & 0x07));
 		} else {
-			keymap.layer--;
-			if (keymap.layer < 0) {
-				keymap.layer = 0;
-			}
+			layers.on(KEY_ACTION_KIND(action) & 0x0F);
 		}
-		DEBUG_PRINTF_KEYEVENT("LAYER->%d\r\n", keymap.layer);
 	}
 
-	static void consumer_play_pause(Keymap& keymap, const bool pressed) {
-		// TODO
+	void releaseHold(const keyaction_t action) {
+		if (tapHoldKind(action) == KEY_ACTION_MT) {
+			keyboard.deleteReportData(KEY_LeftControl | (KEY_ACTION_KIND(action) & 0x07));
+		} else {
+			layers.off(KEY_ACTION_KIND(action) & 0x0F);
+		}
 	}
 
-	void execute(const int row, const int col, const bool pressed) {
-		for (int i = 0; ; i++) {
-			const keyfunc_t& keyfunc = KEYMAP_FUNCTIONS[i];
-			if (keyfunc.row == -1) break;
-			if (keyfunc.col == col && keyfunc.row == row) {
-				DEBUG_PRINTF_KEYEVENT("& %d:%d\r\n", keyfunc.row, keyfunc.row);
-				keyfunc.func(*this, pressed);
-				return;
-			}
+	void release(const keyaction_t action) {
+		if (tapHoldKind(action)) {
+			releaseHold(action);
+			return;
 		}
 
-		if (pressed) {
-			uint8_t key = KEYMAP_DEFINITION[layer][row][col];
-			if (key) {
-				DEBUG_PRINTF_KEYEVENT("D%d %x\r\n", layer, key);
-				keyboard.appendReportData(key);
+		const uint8_t arg = KEY_ACTION_ARG(action);
+		switch (actionKind(action)) {
+			case KEY_ACTION_KEYCODE:
+				if (arg) {
+					DEBUG_PRINTF_KEYEVENT("U %x\r\n", arg);
+					keyboard.deleteReportData(arg);
+				}
+				break;
+			case KEY_ACTION_MO:
+				layers.off(arg);
+				break;
+			case KEY_ACTION_OSL:
+				layers.oneShotRelease(arg);
+				break;
+			case KEY_ACTION_CONSUMER:
+				keyboard.deleteConsumerData(KEY_ACTION_CONSUMER_USAGE(action));
+				break;
+			case KEY_ACTION_SYSTEM:
+				keyboard.deleteSystemData(arg);
+				break;
+		}
+	}
+
+	// queue current state, so that each event reaches the host in its own report
+	void report() {
+		if (!keyboard.queueCurrentReportData()) {
+			DEBUG_PRINTF_KEYEVENT("send() failed");
+		}
+	}
+
+public:
+
+	/**
+	 * Replayed events are reported one by one after the tap / hold action,
+	 * not merged into the report the caller sends after execute().
+	 */
+	void resolveTapHold(const TapHold::Decision decision) {
+		KeyEvent key;
+		keyaction_t action;
+		KeyEvent queued[TapHold::QUEUE_SIZE];
+		const uint8_t count = tapHold.finish(key, action, queued);
+		DEBUG_PRINTF_KEYEVENT("%s %d:%d %dms\r\n", decision == TapHold::TAP ? "TAP" : "HOLD", key.row, key.col, tapHold.latency());
+
+		if (decision == TapHold::TAP) {
+			pressedActions[key.row][key.col] = 0;
+			const uint8_t code = KEY_ACTION_ARG(action);
+			if (code) {
+				if (tapRelease) keyboard.deleteReportData(tapRelease);
+				keyboard.appendReportData(code);
+				layers.keyPressed();
+				tapRelease = code;
 			}
 		} else {
-			// ensure delete all keys on layers
-			for (int i = 0; i < LAYERS; i++) {
-				uint8_t key = KEYMAP_DEFINITION[i][row][col];
-				DEBUG_PRINTF_KEYEVENT("U%d %x\r\n", layer, key);
-				keyboard.deleteReportData(key);
+			pressedActions[key.row][key.col] = action;
+			pressHold(action);
+		}
+		report();
+
+		// may start another tap-hold
+		for (uint8_t i = 0; i < count; i++) {
+			handle(queued[i]);
+			report();
+		}
+	}
+
+	void handle(const KeyEvent& e) {
+		if (tapHold.pending()) {
+			const TapHold::Decision decision = tapHold.event(e);
+			if (decision != TapHold::UNDECIDED) {
+				resolveTapHold(decision);
 			}
+			return;
 		}
+
+		if (e.pressed) {
+			const keyaction_t action = resolve(e.row, e.col);
+			if (tapHoldKind(action)) {
+				tapHold.start(e.row, e.col, action, e.time);
+				return;
+			}
+			pressedActions[e.row][e.col] = action;
+			press(action);
+		} else {
+			release(pressedActions[e.row][e.col]);
+			pressedActions[e.row][e.col] = 0;
+		}
+	}
+
+	Keymap(MyUSBKeyboard& _keyboard) :
+		keyboard(_keyboard),
+		tapHold(TAPPING_TERM_MS, TAP_HOLD_FLAGS),
+		tapRelease(0),
+		now(0)
+	{
+		memset(pressedActions, 0, sizeof(pressedActions));
+	}
+
+	// size of the keymap table (bytes). const and placed in flash.
+	static size_t definitionSize() {
+		return sizeof(KEYMAP_DEFINITION);
+	}
+
+	/**
+	 * Call once per scan before execute(). now: ms
+	 * Returns true when the report was changed.
+	 */
+	bool tick(const uint32_t _now) {
+		now = _now;
+		bool changed = false;
+		if (tapRelease) {
+			keyboard.deleteReportData(tapRelease);
+			tapRelease = 0;
+			changed = true;
+		}
+		const TapHold::Decision decision = tapHold.tick(now);
+		if (decision != TapHold::UNDECIDED) {
+			resolveTapHold(decision);
+			changed = true;
+		}
+		return changed;
+	}
+
+	// a tap-hold key is waiting for its decision
+	bool pending() const {
+		return tapHold.pending() || tapRelease;
+	}
+
+	void execute(const int row, const int col, const bool pressed) {
+		KeyEvent e;
+		e.row = row;
+		e.col = col;
+		e.pressed = pressed;
+		e.time = now;
+		handle(e);
 	}
 };
 
@@ -75,8 +285,21 @@ public:
 #define __________ 0
 // unimplemented in firmware is _undef
 #define _undef 0
+// same as lower layer
+#define _trans KEY_ACTION_TRANSPARENT
+// media keys (Consumer Control / System Control report)
+#define _mPlay CONSUMER(CONSUMER_PLAY_PAUSE)
+#define _mStop CONSUMER(CONSUMER_STOP)
+#define _mNext CONSUMER(CONSUMER_NEXT_TRACK)
+#define _mPrev CONSUMER(CONSUMER_PREV_TRACK)
+#define _mMute CONSUMER(CONSUMER_MUTE)
+#define _mVolU CONSUMER(CONSUMER_VOLUME_UP)
+#define _mVolD CONSUMER(CONSUMER_VOLUME_DOWN)
+#define _sSleep SYSTEM(SYSTEM_SLEEP)
 
-const uint8_t Keymap::KEYMAP_DEFINITION[LAYERS][ROWS][COLS] = {
+// host tests (test/) define their own layout
+#ifndef KEYMAP_DEFINITION_EXTERNAL
+const keyaction_t Keymap::KEYMAP_DEFINITION[LAYERS][ROWS][COLS] = {
 	// layer 0 
 	{
 		/*   { 0          , 1          , 2          , 3          , 4          , 5          , 6          , 7          , 8          , 9          , 10         , 11         , 12         , 13         , 14         , 15 } */
@@ -85,30 +308,34 @@ const uint8_t Keymap::KEYMAP_DEFINITION[LAYERS][ROWS][COLS] = {
 		/*2*/{ _tab       , _Q         , _W         , _E         , _R         , _T         , _Y         , __________ , _T         , _Y         , _U         , _I         , _O         , _P         , _bracketL  , _grave }     , 
 		/*3*/{ _ctrlL     , _A         , _S         , _D         , _F         , _G         , _H         , __________ , _G         , _H         , _J         , _K         , _L         , _semicolon , _quote     , _bracketR }  , 
 		/*4*/{ _shiftL    , _Z         , _X         , _C         , _V         , _B         , _N         , __________ , _B         , _N         , _M         , _comma     , _period    , _slash     , _shiftR    , _bs }        , 
-		/*5*/{ _altL      , _guiL      , _space     , __________ , __________ , _undef     , __________ , __________ , __________ , _arrowU    , _space     , __________ , _guiR      , _altR      , _undef     , _enter }     , 
+		/*5*/{ _altL      , _guiL      , _space     , __________ , __________ , _mPlay     , __________ , __________ , __________ , _arrowU    , _space     , __________ , _guiR      , _altR      , MO(1)      , _enter }     , 
 		/*6*/{ __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , _arrowL    , _arrowD    , _arrowR    , __________ , __________ , __________ , __________ , __________ } , 
 		/*7*/{ __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ } , 
 	},
 	// layer 1
 	{
 		/*   { 0          , 1          , 2          , 3          , 4          , 5          , 6          , 7          , 8          , 9          , 10         , 11         , 12         , 13         , 14         , 15 } */
-		/*0*/{ _esc       , _F1        , _F2        , _F3        , _F4        , _F5        , _F6        , __________ , __________ , _F7        , _F8        , _F9        , _F10       , _F11       , _F12       , _undef }     , 
+		/*0*/{ _esc       , _F1        , _F2        , _F3        , _F4        , _F5        , _F6        , __________ , __________ , _mPrev     , _mPlay     , _mNext     , _mMute     , _mVolD     , _mVolU     , _undef }     , 
 		/*1*/{ _esc       , _1         , _2         , _3         , _4         , _5         , _6         , _7         , _6         , _7         , _8         , _9         , _0         , _dash      , _equal     , _backslash } , 
 		/*2*/{ _tab       , _Q         , _W         , _E         , _R         , _T         , _Y         , __________ , _T         , _Y         , _U         , _I         , _O         , _P         , _arrowU    , _del }     , 
 		/*3*/{ _ctrlL     , _A         , _S         , _D         , _F         , _G         , _H         , __________ , _G         , _H         , _J         , _K         , _L         , _arrowL    , _arrowR    , _bracketR }  , 
 		/*4*/{ _shiftL    , _Z         , _X         , _C         , _V         , _B         , _N         , __________ , _B         , _N         , _M         , _comma     , _period    , _arrowD    , _shiftR    , _bs }        , 
-		/*5*/{ _altL      , _guiL      , _space     , __________ , __________ , _undef     , __________ , __________ , __________ , _arrowU    , _space     , __________ , _guiR      , _altR      , _undef     , _enter }     , 
+		/*5*/{ _altL      , _guiL      , _space     , __________ , __________ , _trans     , __________ , __________ , __________ , _arrowU    , _space     , __________ , _guiR      , _altR      , _trans     , _enter }     , 
 		/*6*/{ __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , _arrowL    , _arrowD    , _arrowR    , __________ , __________ , __________ , __________ , __________ } , 
 		/*7*/{ __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ , __________ } , 
 	},
 };
-
-const keyfunc_t Keymap::KEYMAP_FUNCTIONS[] = {
-	{ 5, 14, &Keymap::switch_layer },
-	{ 5, 5, &Keymap::consumer_play_pause },
-	{ -1, -1, 0 } /* for iteration */
-};
+#endif
 
 #undef __________
 #undef _undef
+#undef _trans
+#undef _mPlay
+#undef _mStop
+#undef _mNext
+#undef _mPrev
+#undef _mMute
+#undef _mVolU
+#undef _mVolD
+#undef _sSleep
 
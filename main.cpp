@@ -1,43 +1,114 @@
 #include "mbed.h"
 #include "config.h"
 
+#include "USBComposite.h"
+#if USB_VENDOR_INTERFACE
+#include "USBVendorFunction.h"
+#endif
 #include "MyUSBKeyboard.h"
 #include "KeyboardMatrixController.h"
 #include "keymap.h"
+#include "Debouncer.h"
+#include "ScanScheduler.h"
+#include "ScanProcessor.h"
 
+Serial serial(UART_TX, UART_RX);
+
+// keyboard (+ CDC console, vendor interface) as one composite device
+static USBComposite usb(0x1235, 0x0050, 0x0001);
 static MyUSBKeyboard keyboard;
+#if USB_CDC_CONSOLE
+USBCDCFunction console;
+#endif
+#if USB_VENDOR_INTERFACE
+static USBVendorFunction vendor;
+#endif
 static I2C i2c(P0_5, P0_4);
-static KeyboardMatrixController keyboardMatrixController(i2c);
+// MCP23017 7-bit addresses. One expander per 8 columns (up to 8 on one bus)
+static const uint8_t EXPANDER_ADDRESSES[COLS / 8] = {
+	0b0100000,
+	0b0100100,
+};
+static KeyboardMatrixController<COLS / 8> keyboardMatrixController(i2c, EXPANDER_ADDRESSES);
+#if I2C_ASYNC
+static I2CTransactionQueue i2cQueue;
+// a scan is on the bus (or finished) and not collected yet, started in scanFrame
+static bool scanPending = false;
+static uint16_t scanFrame = 0;
+#endif
+// GpioKeyboardMatrix or SimulatedKeyboardMatrix can be used instead
+static KeyboardMatrix& matrix = keyboardMatrixController;
 static Keymap keymap(keyboard);
 
 // Interrupt from MCP23017
-// (pulled-up and two MCP23017 is configured with open drain INT)
+// (pulled-up and all MCP23017 are configured with open drain INT)
 static InterruptIn keyboardInterruptIn(P0_2);
 
-// delay for interrupt
-static volatile int8_t pollCount = 50;
+static ScanScheduler scheduler(
+	SCAN_INTERVAL_FAST_US,
+	SCAN_INTERVAL_SLOW_US,
+	SCAN_SLOW_AFTER_MS,
+	SCAN_STOP_AFTER_MS
+);
 
 static void keyboardInterrupt() {
 	// just for wakeup
-	pollCount = 25;
+	scheduler.wakeup();
 }
 
 // ROWS=8
 // COLS=16
-// 列ごとに1バイトにパックしてキーの状態を保持する
-static uint8_t keys[3][COLS];
-static uint8_t state = 0;
-#define is_pressed(keys, row, col) (!!(keys[col] & (1<<row)))
+// scan 結果 (列ごとに1バイト)
+static uint8_t keys[COLS];
+
+#if DEBOUNCE == DEBOUNCE_EAGER
+typedef EagerDebouncer<ROWS, COLS> KeyDebouncer;
+static KeyDebouncer debouncer(DEBOUNCE_RELEASE_MS);
+#elif DEBOUNCE == DEBOUNCE_COUNTER
+typedef CounterDebouncer<ROWS, COLS> KeyDebouncer;
+static KeyDebouncer debouncer;
+#else
+typedef FilterDebouncer<ROWS, COLS> KeyDebouncer;
+static KeyDebouncer debouncer;
+#endif
+// 行ごとに 32bit ワードへパックしてデバウンスし、変化したキーを keymap へ
+static ScanProcessor<KeyDebouncer> processor(debouncer, keymap, keyboard);
+
+// ms since boot for debouncer (us_ticker wraps every ~71min, this does not)
+static uint32_t millis() {
+	static uint32_t last = us_ticker_read();
+	static uint32_t ms = 0;
+	const uint32_t elapsed = (us_ticker_read() - last) / 1000;
+	ms += elapsed;
+	last += elapsed * 1000;
+	return ms;
+}
 
-// 120Hz = 8.3ms
-// USB polling interval min is 8ms on Windows
-// (ref. https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/content/usbspec/ns-usbspec-_usb_endpoint_descriptor)
-static const uint8_t HID_QUEUE_DURATION_MS = 8;
-static const uint8_t BOUNCE_TIME = 4;
+#if SCAN_SOF_SYNC
+// USB SOF (every 1ms, ISR)
+static void startOfFrame(int frameNumber) {
+	scheduler.sof();
+}
+#endif
 
 DigitalOut led(LED1);
 
 int main() {
+	if (!usb.add(&keyboard)) {
+		DEBUG_PRINTF("usb: keyboard does not fit\r\n");
+	}
+#if USB_CDC_CONSOLE
+	if (!usb.add(&console)) {
+		DEBUG_PRINTF("usb: console does not fit\r\n");
+	}
+#endif
+#if USB_VENDOR_INTERFACE
+	if (!usb.add(&vendor)) {
+		DEBUG_PRINTF("usb: vendor interface does not fit\r\n");
+	}
+#endif
+	usb.connect();
+
 	// 100k
 	// i2c.frequency(100000);
 	// 400k (max @3.3V for MCP23017)
@@ -46,47 +117,100 @@ int main() {
 	keyboardInterruptIn.mode(PullUp);
 	keyboardInterruptIn.fall(keyboardInterrupt);
 
-	keyboardMatrixController.init();
+	matrix.init();
+	if (matrix.cols() != COLS) {
+		DEBUG_PRINTF("matrix has %d cols, keymap has %d\r\n", matrix.cols(), COLS);
+	}
+
+#if DEBUG
+	{
+		const uint32_t before = keyboardMatrixController.transactionCount();
+		keyboardMatrixController.scanKeyboard(keys);
+		DEBUG_PRINTF("i2c transactions per scan: %d\r\n", keyboardMatrixController.transactionCount() - before);
+		DEBUG_PRINTF("scan time: %dus\r\n", keyboardMatrixController.scanTiming().last);
+		DEBUG_PRINTF("keymap: definition %d bytes (flash), state %d bytes (RAM)\r\n",
+			Keymap::definitionSize(), sizeof(keymap));
+	}
+#endif
+
+#if SCAN_SOF_SYNC
+	scheduler.setSofSync(true);
+	scheduler.setPhaseLock(SCAN_SOF_PHASE_LOCK, SCAN_SOF_MARGIN_US);
+	keyboard.attachSOF(startOfFrame);
+#endif
+	scheduler.start(millis());
 
 	while (1) {
-		for (; pollCount > 0; pollCount--) {
-
-			uint8_t (&keysCurr)[COLS] = keys[(state - 0 + 3) % 3];
-			uint8_t (&keysPrev)[COLS] = keys[(state - 1 + 3) % 3];
-			uint8_t (&keysLast)[COLS] = keys[(state - 2 + 3) % 3];
-
-			keyboardMatrixController.scanKeyboard(keysCurr);
-
-			bool queue = false;
-
-			for (int col = 0; col < COLS; col++) {
-				const uint8_t filtered = (~(keysPrev[col] ^ keysCurr[col]) & keysCurr[col]);
-				const uint8_t changed = keysLast[col] ^ filtered;
-				keysLast[col] = filtered;
-				if (changed) queue = true;
-				for (int row = 0; row < ROWS; row++) {
-					if (changed & (1<<row)) {
-						bool pressed = keysCurr[col] & (1<<row);
-						DEBUG_PRINTF_KEYEVENT("changed: col=%d, row=%d / pressed=%d\r\n", col, row, pressed);
-						keymap.execute(row, col, pressed);
-					}
-				}
+		// wait for the Ticker, SOF or MCP23017 interrupt. __WFI() keeps the
+		// USB clock running (mbed sleep() stalls USB). With IRQs masked, an
+		// interrupt between due() and __WFI() still wakes it up
+		__disable_irq();
+		if (!scheduler.due()) {
+			__WFI();
+			__enable_irq();
+			continue;
+		}
+		__enable_irq();
+
+#if I2C_ASYNC
+		// pipelined: collect the scan started on the previous due, start the
+		// next one, and process while it is on the bus
+		if (!scanPending) {
+			scanFrame = keyboard.frameNumber();
+			keyboardMatrixController.startScan(i2cQueue);
+		}
+		while (!keyboardMatrixController.scanCompleted());
+		keyboardMatrixController.collectScan(keys);
+		keyboard.inputSampled(scanFrame);
+		scanFrame = keyboard.frameNumber();
+		keyboardMatrixController.startScan(i2cQueue);
+		scanPending = true;
+#else
+		keyboard.inputSampled();
+		matrix.scan(keys);
+#endif
+
+		const uint32_t now = millis();
+		const bool active = processor.process(keys, now);
+
+		// fast while keys are down or bouncing, then slow, then interrupt only
+		scheduler.setTargetPhase(keyboard.inTokenPhase());
+		scheduler.scanned(active, now);
+#if I2C_ASYNC
+		// next due is far in slow / interrupt mode: the pending scan would be stale
+		if (scheduler.currentMode() != ScanScheduler::MODE_FAST) {
+			scanPending = false;
+		}
+#endif
+
+#if DEBUG
+		if (scheduler.currentMode() == ScanScheduler::MODE_INTERRUPT && scheduler.jitterStats().count) {
+			const ScanScheduler::JitterStats& jitter = scheduler.jitterStats();
+			DEBUG_PRINTF("scan jitter: min=%dus max=%dus avg=%dus (%d scans)\r\n", jitter.min, jitter.max, jitter.totalAbs / jitter.count, jitter.count);
+			scheduler.resetJitter();
+
+			const MyUSBKeyboard::ReportQueueStats& reports = keyboard.reportQueueStats();
+			DEBUG_PRINTF("reports: queued=%d sent=%d merged=%d maxDepth=%d\r\n", reports.queued, reports.sent, reports.merged, reports.maxDepth);
+
+			// input to report latency in USB frames (1ms)
+			const MyUSBKeyboard::LatencyHistogram& latency = keyboard.latencyHistogram();
+			DEBUG_PRINTF("latency frames:");
+			for (int i = 0; i < MyUSBKeyboard::LATENCY_BUCKETS; i++) {
+				if (latency.counts[i]) DEBUG_PRINTF(" %d%s=%d", i, i == MyUSBKeyboard::LATENCY_BUCKETS - 1 ? "+" : "", latency.counts[i]);
 			}
-			state = (state + 1) % 3;
-
-			if (queue) {
-				// ensure unpress event
-				pollCount++;
-				bool ok = keyboard.queueCurrentReportData();
-				if (!ok) {
-					DEBUG_PRINTF_KEYEVENT("send() failed");
-				}
+			DEBUG_PRINTF(" (scan start %dus after SOF, busy %dus, IN token %dus)\r\n",
+				scheduler.scanStartPhase(), scheduler.busyTime(), keyboard.inTokenPhase());
+			keyboard.resetLatencyHistogram();
+
+			// endpoint buffers in USB RAM
+			USBHAL::USB_RAM_USAGE usbRam;
+			USBHAL::usbRamUsage(&usbRam);
+			DEBUG_PRINTF("usb ram: used=%d peak=%d padding=%d of %d bytes, failed=%d\r\n", usbRam.used, usbRam.peak, usbRam.padding, usbRam.size, usbRam.failed);
+			for (uint8_t ep = EP1OUT; ep < NUMBER_OF_PHYSICAL_ENDPOINTS; ep++) {
+				const uint32_t address = USBHAL::endpointBufferAddress(ep, 0);
+				if (address) DEBUG_PRINTF("  ep%d: %08x %08x\r\n", ep, address, USBHAL::endpointBufferAddress(ep, 1));
 			}
-			wait_ms(BOUNCE_TIME);
 		}
-
-		// sleep causes USB stall
-		// sleep();
+#endif
 	}
 }
-
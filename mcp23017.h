@@ -1,3 +1,4 @@
+#include "I2CTransactionQueue.h"
 
 /**
  * MCP23017 のアドレスモードについて：
@@ -14,11 +15,18 @@
  * Sequential mode: アドレスポインタの自動インクリメントがオン
  *     I2C eeprom みたいな挙動になる
  *
+ * Byte Mode + IOCON.BANK=0 では GPIOA へ書き込んだ直後にアドレスポインタが
+ * GPIOB を指すので、repeated start でそのまま読み出せば
+ * 「列のドライブ」と「行の読み出し」を 1 トランザクションにまとめられる (write8read8)
+ *
  */
 class MCP23017 {
-	I2C& i2c;
+	I2C* i2c;
 	uint8_t address;
 
+	// number of bus transactions (START ... STOP) issued by this instance
+	mutable uint32_t transactions;
+
 public:
 	// BANK=1
 	enum RegisterAddress {
@@ -89,24 +97,51 @@ public:
 		I2C& _i2c,
 		uint8_t _address
 	) :
-		i2c(_i2c),
-		address(_address<<1)
+		i2c(&_i2c),
+		address(_address<<1),
+		transactions(0)
+	{
+	}
+
+	/**
+	 * For arrays of expanders. attach() before use.
+	 */
+	MCP23017() :
+		i2c(NULL),
+		address(0),
+		transactions(0)
 	{
 	}
 
+	void attach(I2C& _i2c, uint8_t _address) {
+		i2c = &_i2c;
+		address = _address<<1;
+	}
+
+	// 7-bit slave address
+	uint8_t slaveAddress() const {
+		return address >> 1;
+	}
+
+	uint32_t transactionCount() const {
+		return transactions;
+	}
+
 	uint8_t read8(const RegisterAddress reg, int& error) const {
 		char data[1];
 		data[0] = reg;
-		i2c.write(address, data, 1, true);
-		error = i2c.read(address, data, 1, false);
+		transactions++;
+		i2c->write(address, data, 1, true);
+		error = i2c->read(address, data, 1, false);
 		return data[0];
 	}
 
 	uint16_t read16(const RegisterAddress reg, int& error) const {
 		char data[2];
 		data[0] = reg;
-		i2c.write(address, data, 1, true);
-		error = i2c.read(address, data, 2, false);
+		transactions++;
+		i2c->write(address, data, 1, true);
+		error = i2c->read(address, data, 2, false);
 		return (static_cast<uint16_t>(data[0]) << 8) | static_cast<uint16_t>(data[1]);
 	}
 
@@ -114,7 +149,95 @@ public:
 		char d[2];
 		d[0] = reg;
 		d[1] = data;
-		return i2c.write(address, d, 2, false) == I2C_WRITE_MULTIBYTES_SUCCESS;
+		transactions++;
+		return i2c->write(address, d, 2, false) == I2C_WRITE_MULTIBYTES_SUCCESS;
+	}
+
+	/**
+	 * Write reg, then read the paired register (A<->B) in the same
+	 * transaction with repeated start.
+	 * Only valid with IOCON.BANK=0 and IOCON.SEQOP=1 (byte mode).
+	 */
+	uint8_t write8read8(const RegisterAddress reg, uint8_t data, int& error) const {
+		char d[2];
+		d[0] = reg;
+		d[1] = data;
+		transactions++;
+		error = i2c->write(address, d, 2, true);
+		if (error != I2C_WRITE_MULTIBYTES_SUCCESS) {
+			return 0;
+		}
+		error = i2c->read(address, d, 1, false);
+		return d[0];
+	}
+
+	/**
+	 * Non-blocking write8. Returns false when the queue is full.
+	 */
+	bool queueWrite8(
+		I2CTransactionQueue& queue,
+		const RegisterAddress reg,
+		uint8_t data,
+		I2CTransaction::callback_t callback = NULL,
+		void* context = NULL
+	) const {
+		I2CTransaction* t = queue.reserve();
+		if (!t) return false;
+		t->address = address;
+		t->tx[0] = reg;
+		t->tx[1] = data;
+		t->txLength = 2;
+		t->callback = callback;
+		t->context = context;
+		transactions++;
+		queue.commit();
+		return true;
+	}
+
+	/**
+	 * Non-blocking read8. The value is in transaction.rx[0] of the callback.
+	 */
+	bool queueRead8(
+		I2CTransactionQueue& queue,
+		const RegisterAddress reg,
+		I2CTransaction::callback_t callback,
+		void* context
+	) const {
+		I2CTransaction* t = queue.reserve();
+		if (!t) return false;
+		t->address = address;
+		t->tx[0] = reg;
+		t->txLength = 1;
+		t->rxLength = 1;
+		t->callback = callback;
+		t->context = context;
+		transactions++;
+		queue.commit();
+		return true;
+	}
+
+	/**
+	 * Non-blocking write8read8. The value is in transaction.rx[0] of the callback.
+	 */
+	bool queueWrite8Read8(
+		I2CTransactionQueue& queue,
+		const RegisterAddress reg,
+		uint8_t data,
+		I2CTransaction::callback_t callback,
+		void* context
+	) const {
+		I2CTransaction* t = queue.reserve();
+		if (!t) return false;
+		t->address = address;
+		t->tx[0] = reg;
+		t->tx[1] = data;
+		t->txLength = 2;
+		t->rxLength = 1;
+		t->callback = callback;
+		t->context = context;
+		transactions++;
+		queue.commit();
+		return true;
 	}
 
 	int write16(const RegisterAddress reg, uint16_t data) const {
@@ -122,7 +245,8 @@ public:
 		d[0] = reg;
 		d[1] = data >> 8;
 		d[2] = data & 0xff;
-		return i2c.write(address, d, 3, false) == I2C_WRITE_MULTIBYTES_SUCCESS;
+		transactions++;
+		return i2c->write(address, d, 3, false) == I2C_WRITE_MULTIBYTES_SUCCESS;
 	}
 };
 
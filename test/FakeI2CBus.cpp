@@ -0,0 +1,323 @@
+/**
+ * LPC11U I2C master state machine and register slaves for host tests.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mbed.h"
+#include "FakeI2CBus.h"
+
+namespace {
+	const uint32_t AA = 1<<2;
+	const uint32_t SI = 1<<3;
+	const uint32_t STO = 1<<4;
+	const uint32_t STA = 1<<5;
+
+	// no relevant state, bus free
+	const uint8_t STAT_IDLE = 0xF8;
+
+	// MCP23017 registers (IOCON.BANK=0)
+	const uint8_t IODIRA = 0x00;
+	const uint8_t IPOLB = 0x03;
+	const uint8_t IOCON = 0x0A;
+	const uint8_t IOCON_ALIAS = 0x0B;
+	const uint8_t GPIOA = 0x12;
+	const uint8_t GPIOB = 0x13;
+	const uint8_t SEQOP = 1<<5;
+
+	struct Slave {
+		bool present;
+		bool nakData;
+		uint8_t pointer;
+		uint8_t registers[32];
+		// GPIOB reads the key matrix instead of registers[GPIOB]
+		bool matrix;
+		// rows held per column (GPIOA bit)
+		uint8_t keys[8];
+	};
+
+	struct Bus {
+		uint32_t con;
+		uint8_t stat;
+		uint8_t dat;
+		// bus owned between START and STOP
+		bool held;
+
+		Slave slaves[128];
+		Slave* slave;
+		// next written byte is the register pointer
+		bool pointerWrite;
+
+		char trace[4096];
+	};
+
+	Bus bus;
+	FakeI2CRegisters registers;
+
+	// SEQOP=0: pointer increments. SEQOP=1 (byte mode): it toggles within
+	// the A/B register pair, so GPIOB follows a write of GPIOA
+	void advance(Slave* slave) {
+		if (slave->registers[IOCON] & SEQOP) {
+			slave->pointer ^= 1;
+		} else {
+			slave->pointer = (slave->pointer + 1) & 31;
+		}
+	}
+
+	// rows pulled low by keys of columns driven low, through IPOLB
+	uint8_t readMatrix(const Slave* slave) {
+		const uint8_t low = ~slave->registers[GPIOA] & ~slave->registers[IODIRA];
+		uint8_t rows = 0;
+		for (int col = 0; col < 8; col++) {
+			if (low & (1 << col)) rows |= slave->keys[col];
+		}
+		return ~rows ^ slave->registers[IPOLB];
+	}
+
+	void writeByte(Slave* slave, const uint8_t value) {
+		if (bus.pointerWrite) {
+			slave->pointer = value & 31;
+			bus.pointerWrite = false;
+			return;
+		}
+		slave->registers[slave->pointer] = value;
+		// one IOCON at both addresses
+		if (slave->pointer == IOCON) slave->registers[IOCON_ALIAS] = value;
+		if (slave->pointer == IOCON_ALIAS) slave->registers[IOCON] = value;
+		advance(slave);
+	}
+
+	uint8_t readByte(Slave* slave) {
+		const uint8_t value = (slave->matrix && slave->pointer == GPIOB) ?
+			readMatrix(slave) : slave->registers[slave->pointer];
+		advance(slave);
+		return value;
+	}
+
+	void trace(const char* format, const uint8_t value = 0) {
+		char token[8];
+		snprintf(token, sizeof(token), format, value);
+		const size_t length = strlen(bus.trace);
+		if (length + strlen(token) + 2 >= sizeof(bus.trace)) return;
+		if (length) strcat(bus.trace, " ");
+		strcat(bus.trace, token);
+	}
+
+	void interrupt(const uint8_t stat) {
+		bus.stat = stat;
+		bus.con |= SI;
+	}
+
+	void start() {
+		trace("S");
+		bus.held = true;
+		interrupt(0x08);
+	}
+
+	// SI cleared: the step the master asked for
+	void step() {
+		if (bus.con & STO) {
+			trace("P");
+			bus.con &= ~STO;
+			bus.held = false;
+			bus.stat = STAT_IDLE;
+			if (bus.con & STA) start();
+			return;
+		}
+
+		if ((bus.con & STA) && bus.held) {
+			trace("Sr");
+			interrupt(0x10);
+			return;
+		}
+
+		switch (bus.stat) {
+			case 0x08:
+			case 0x10: {
+				const uint8_t address = bus.dat >> 1;
+				const bool read = bus.dat & 1;
+				trace(read ? "R%02x" : "W%02x", address);
+				bus.slave = bus.slaves[address].present ? &bus.slaves[address] : NULL;
+				bus.pointerWrite = true;
+				if (bus.slave) {
+					trace("A");
+					interrupt(read ? 0x40 : 0x18);
+				} else {
+					trace("N");
+					interrupt(read ? 0x48 : 0x20);
+				}
+				return;
+			}
+
+			case 0x18:
+			case 0x28:
+				trace("%02x", bus.dat);
+				if (bus.slave->nakData) {
+					trace("N");
+					interrupt(0x30);
+					return;
+				}
+				writeByte(bus.slave, bus.dat);
+				trace("A");
+				interrupt(0x28);
+				return;
+
+			case 0x40:
+			case 0x50:
+				bus.dat = readByte(bus.slave);
+				trace("r%02x", bus.dat);
+				if (bus.con & AA) {
+					trace("A");
+					interrupt(0x50);
+				} else {
+					trace("N");
+					interrupt(0x58);
+				}
+				return;
+		}
+
+		// master must STOP or repeat START after NACK; anything else hangs the bus
+		trace("?");
+	}
+
+	// START or repeated START and the address byte. false on NACK (bus released)
+	bool blockingAddress(const int address8) {
+		trace(bus.held ? "Sr" : "S");
+		bus.held = true;
+		const uint8_t address = (address8 >> 1) & 0x7F;
+		trace((address8 & 1) ? "R%02x" : "W%02x", address);
+		bus.slave = bus.slaves[address].present ? &bus.slaves[address] : NULL;
+		bus.pointerWrite = true;
+		if (!bus.slave) {
+			trace("N");
+			trace("P");
+			bus.held = false;
+			return false;
+		}
+		trace("A");
+		return true;
+	}
+
+	void blockingEnd(const bool repeated) {
+		if (repeated) return;
+		trace("P");
+		bus.held = false;
+	}
+
+	int blockingWrite(const int address8, const char* data, const int length, const bool repeated) {
+		if (!blockingAddress(address8 & ~1)) return 1;
+		for (int i = 0; i < length; i++) {
+			trace("%02x", (uint8_t)data[i]);
+			if (bus.slave->nakData) {
+				trace("N");
+				blockingEnd(false);
+				return 2;
+			}
+			writeByte(bus.slave, data[i]);
+			trace("A");
+		}
+		blockingEnd(repeated);
+		return 0;
+	}
+
+	int blockingRead(const int address8, char* data, const int length, const bool repeated) {
+		if (!blockingAddress(address8 | 1)) return 1;
+		for (int i = 0; i < length; i++) {
+			data[i] = readByte(bus.slave);
+			trace("r%02x", (uint8_t)data[i]);
+			trace(i == length - 1 ? "N" : "A");
+		}
+		blockingEnd(repeated);
+		return 0;
+	}
+}
+
+FakeI2CRegister::operator uint32_t() const {
+	switch (id) {
+		case CONSET: return bus.con;
+		case STAT: return bus.stat;
+		case DAT: return bus.dat;
+	}
+	return 0;
+}
+
+FakeI2CRegister& FakeI2CRegister::operator=(const uint32_t value) {
+	switch (id) {
+		case CONSET:
+			bus.con |= value;
+			// START on a free bus is taken at once, otherwise on SI clear
+			if ((value & STA) && !bus.held && !(bus.con & SI)) {
+				start();
+			}
+			break;
+		case CONCLR:
+			bus.con &= ~value;
+			if ((value & SI) && bus.held) {
+				step();
+			}
+			break;
+		case DAT:
+			bus.dat = value;
+			break;
+	}
+	return *this;
+}
+
+namespace FakeI2CBus {
+	void reset() {
+		memset(&bus, 0, sizeof(bus));
+		bus.stat = STAT_IDLE;
+	}
+
+	void attach(const uint8_t address) {
+		memset(&bus.slaves[address & 0x7F], 0, sizeof(Slave));
+		bus.slaves[address & 0x7F].present = true;
+	}
+
+	uint8_t& reg(const uint8_t address, const uint8_t reg) {
+		return bus.slaves[address & 0x7F].registers[reg & 31];
+	}
+
+	void nakData(const uint8_t address, const bool nak) {
+		bus.slaves[address & 0x7F].nakData = nak;
+	}
+
+	void setKeys(const uint8_t address, const uint8_t (&rows)[8]) {
+		Slave& slave = bus.slaves[address & 0x7F];
+		slave.matrix = true;
+		memcpy(slave.keys, rows, sizeof(slave.keys));
+	}
+
+	int write(const int address, const char* data, const int length, const bool repeated) {
+		return blockingWrite(address, data, length, repeated);
+	}
+
+	int read(const int address, char* data, const int length, const bool repeated) {
+		return blockingRead(address, data, length, repeated);
+	}
+
+	int run(void (*handler)()) {
+		int count = 0;
+		while ((bus.con & SI) && fakeIrqEnabled(I2C_IRQn) && count < 10000) {
+			handler();
+			count++;
+		}
+		return count;
+	}
+
+	bool interruptPending() {
+		return bus.con & SI;
+	}
+
+	const char* trace() {
+		return bus.trace;
+	}
+
+	void clearTrace() {
+		bus.trace[0] = 0;
+	}
+
+	FakeI2CRegisters* registers() {
+		return &::registers;
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef __FAKE_I2C_BUS_H__
+#define __FAKE_I2C_BUS_H__
+
+#include <stdint.h>
+
+/**
+ * LPC11U I2C master and slaves on Linux (FakeI2CBus.cpp).
+ *
+ * LPC_I2C->CONSET / CONCLR / STAT / DAT run the master state machine of
+ * the LPC11U (UM10462 15.10): clearing SI takes the next step on the bus
+ * with the current STA / STO / AA flags and DAT, and sets SI again with
+ * the new STAT. Slaves are register files addressed like MCP23017
+ * (IOCON.BANK=0): the first written byte is the register pointer. It
+ * increments after each byte, or with IOCON.SEQOP set (byte mode) toggles
+ * between the A and B register of a pair. With setKeys(), GPIOB reads the
+ * rows of the keys on the columns GPIOA drives low, through IPOLB.
+ *
+ * write() / read() are the blocking transfers of the mbed I2C stub.
+ *
+ * Bus conditions are recorded in trace() as space separated tokens:
+ *   S / Sr / P   START, repeated START, STOP
+ *   W20 / R20    SLA+W / SLA+R of 7-bit address 0x20
+ *   12           data byte written by the master
+ *   r12          data byte read by the master
+ *   A / N        ACK / NACK of the previous byte
+ */
+class FakeI2CRegister {
+	const uint8_t id;
+
+public:
+	enum { CONSET, CONCLR, STAT, DAT };
+
+	FakeI2CRegister(const uint8_t _id) : id(_id) {}
+
+	operator uint32_t() const;
+	FakeI2CRegister& operator=(const uint32_t value);
+};
+
+struct FakeI2CRegisters {
+	FakeI2CRegister CONSET;
+	FakeI2CRegister STAT;
+	FakeI2CRegister DAT;
+	FakeI2CRegister CONCLR;
+
+	FakeI2CRegisters() :
+		CONSET(FakeI2CRegister::CONSET),
+		STAT(FakeI2CRegister::STAT),
+		DAT(FakeI2CRegister::DAT),
+		CONCLR(FakeI2CRegister::CONCLR)
+	{}
+};
+
+namespace FakeI2CBus {
+	// bus idle, no slaves, trace cleared
+	void reset();
+
+	// slave with 7-bit address and 32 registers (zero)
+	void attach(uint8_t address);
+
+	uint8_t& reg(uint8_t address, uint8_t reg);
+
+	// slave NACKs data bytes written to it (address is still ACKed)
+	void nakData(uint8_t address, bool nak);
+
+	// rows held per column (GPIOA bit 0-7) of the expander
+	void setKeys(uint8_t address, const uint8_t (&rows)[8]);
+
+	// mbed I2C::write / read: 8-bit address, 0 on success
+	int write(int address, const char* data, int length, bool repeated);
+	int read(int address, char* data, int length, bool repeated);
+
+	/**
+	 * Run the I2C interrupt handler while SI is set and I2C_IRQn enabled,
+	 * as the NVIC would. Returns number of interrupts taken.
+	 */
+	int run(void (*handler)());
+
+	// SI set: the master waits for the interrupt handler
+	bool interruptPending();
+
+	const char* trace();
+	void clearTrace();
+
+	FakeI2CRegisters* registers();
+}
+
+#define LPC_I2C (FakeI2CBus::registers())
+
+#endif
@@ -0,0 +1,441 @@
+/**
+ * USBHAL backed by a simulated LPC11U USB controller and host (FakeUSBHost.h).
+ * Replaces USBHAL_LPC11U.cpp in host tests.
+ */
+
+#include "USBHAL.h"
+#include "USBDevice_Types.h"
+#include "FakeUSBHost.h"
+
+#define IN_EP(endpoint) ((endpoint) & 1U ? true : false)
+#define OUT_EP(endpoint) ((endpoint) & 1U ? false : true)
+
+USBHAL * USBHAL::instance;
+
+namespace {
+	struct Buffer {
+		bool active;
+		uint32_t length;
+		uint8_t data[MAX_PACKET_SIZE_EP1];
+	};
+
+	struct Endpoint {
+		bool realised;
+		bool stalled;
+		bool doubleBuffered;
+		uint32_t maxPacket;
+		// USB RAM taken by the buffers (64 byte blocks as on the LPC11U)
+		uint32_t ram;
+		Buffer buffer[2];
+		// software: buffer written next, hardware: buffer sent next
+		uint8_t next;
+		uint8_t inUse;
+	};
+
+	struct Controller {
+		bool connected;
+		void (*isr)(void);
+
+		// pending interrupts, taken by usbisr()
+		bool sof;
+		uint16_t frame;
+		bool reset;
+		bool setup;
+		bool ep0out;
+		bool ep0in;
+		uint32_t ep;
+
+		uint8_t setupPacket[SETUP_PACKET_SIZE];
+		// EP0: OUT armed by EP0read(), IN armed by EP0write()
+		bool ep0OutArmed;
+		uint8_t ep0Out[MAX_PACKET_SIZE_EP0];
+		uint32_t ep0OutLength;
+		bool ep0InArmed;
+		uint8_t ep0In[MAX_PACKET_SIZE_EP0];
+		uint32_t ep0InLength;
+		bool ep0Stalled;
+
+		Endpoint endpoints[NUMBER_OF_PHYSICAL_ENDPOINTS];
+	};
+
+	Controller controller;
+
+	// USB RAM for endpoint buffers (0: unlimited), kept across devices
+	uint32_t usbRamSize;
+	uint32_t usbRamFailed;
+
+	uint32_t usbRamUsed() {
+		uint32_t used = 0;
+		for (int i = 0; i < NUMBER_OF_PHYSICAL_ENDPOINTS; i++) {
+			used += controller.endpoints[i].ram;
+		}
+		return used;
+	}
+
+	void interrupt() {
+		if (controller.connected && controller.isr) {
+			controller.isr();
+		}
+	}
+
+	void resetEndpoints() {
+		memset(controller.endpoints, 0, sizeof(controller.endpoints));
+	}
+}
+
+
+USBHAL::USBHAL(void) {
+    epCallback[0] = &USBHAL::EP1_OUT_callback;
+    epCallback[1] = &USBHAL::EP1_IN_callback;
+    epCallback[2] = &USBHAL::EP2_OUT_callback;
+    epCallback[3] = &USBHAL::EP2_IN_callback;
+    epCallback[4] = &USBHAL::EP3_OUT_callback;
+    epCallback[5] = &USBHAL::EP3_IN_callback;
+    epCallback[6] = &USBHAL::EP4_OUT_callback;
+    epCallback[7] = &USBHAL::EP4_IN_callback;
+
+    memset(&controller, 0, sizeof(controller));
+    controller.isr = &USBHAL::_usbisr;
+    instance = this;
+}
+
+USBHAL::~USBHAL(void) {
+    controller.isr = NULL;
+}
+
+void USBHAL::connect(void) {
+    controller.connected = true;
+}
+
+void USBHAL::disconnect(void) {
+    controller.connected = false;
+}
+
+void USBHAL::configureDevice(void) {
+}
+
+void USBHAL::unconfigureDevice(void) {
+}
+
+void USBHAL::setAddress(uint8_t address) {
+}
+
+void USBHAL::remoteWakeup(void) {
+}
+
+void USBHAL::EP0setup(uint8_t *buffer) {
+    memcpy(buffer, controller.setupPacket, SETUP_PACKET_SIZE);
+}
+
+void USBHAL::EP0read(void) {
+    controller.ep0OutArmed = true;
+}
+
+void USBHAL::EP0readStage(void) {
+}
+
+uint32_t USBHAL::EP0getReadResult(uint8_t *buffer) {
+    memcpy(buffer, controller.ep0Out, controller.ep0OutLength);
+    return controller.ep0OutLength;
+}
+
+void USBHAL::EP0write(uint8_t *buffer, uint32_t size) {
+    if (size > 0) {
+        memcpy(controller.ep0In, buffer, size);
+    }
+    controller.ep0InLength = size;
+    controller.ep0InArmed = true;
+}
+
+void USBHAL::EP0getWriteResult(void) {
+}
+
+void USBHAL::EP0stall(void) {
+    controller.ep0Stalled = true;
+}
+
+EP_STATUS USBHAL::endpointRead(uint8_t endpoint, uint32_t maximumSize) {
+    Endpoint &e = controller.endpoints[endpoint];
+    e.buffer[0].active = true;
+    e.buffer[0].length = 0;
+    return EP_PENDING;
+}
+
+EP_STATUS USBHAL::endpointReadResult(uint8_t endpoint, uint8_t *data, uint32_t *bytesRead) {
+    Endpoint &e = controller.endpoints[endpoint];
+    if (e.buffer[0].active) {
+        return EP_PENDING;
+    }
+    memcpy(data, e.buffer[0].data, e.buffer[0].length);
+    *bytesRead = e.buffer[0].length;
+    return EP_COMPLETED;
+}
+
+uint8_t * USBHAL::endpointWriteBuffer(uint8_t endpoint) {
+    if ((endpoint >= NUMBER_OF_PHYSICAL_ENDPOINTS) || (endpoint < 2) || OUT_EP(endpoint)) {
+        return NULL;
+    }
+    Endpoint &e = controller.endpoints[endpoint];
+    if (!e.realised || e.stalled || e.buffer[e.next].active) {
+        return NULL;
+    }
+    return e.buffer[e.next].data;
+}
+
+EP_STATUS USBHAL::endpointWriteBuffered(uint8_t endpoint, uint32_t size) {
+    if (endpointWriteBuffer(endpoint) == NULL) {
+        return EP_INVALID;
+    }
+    Endpoint &e = controller.endpoints[endpoint];
+    if (size > e.maxPacket) {
+        return EP_INVALID;
+    }
+    e.buffer[e.next].length = size;
+    e.buffer[e.next].active = true;
+    if (e.doubleBuffered) {
+        e.next ^= 1;
+    }
+    return EP_PENDING;
+}
+
+EP_STATUS USBHAL::endpointWrite(uint8_t endpoint, uint8_t *data, uint32_t size) {
+    if ((data == NULL) || (endpoint >= NUMBER_OF_PHYSICAL_ENDPOINTS)) {
+        return EP_INVALID;
+    }
+    Endpoint &e = controller.endpoints[endpoint];
+    if (size > e.maxPacket) {
+        return EP_INVALID;
+    }
+    uint8_t *buffer = endpointWriteBuffer(endpoint);
+    if (buffer == NULL) {
+        return e.stalled ? EP_STALLED : EP_INVALID;
+    }
+    memcpy(buffer, data, size);
+    return endpointWriteBuffered(endpoint, size);
+}
+
+EP_STATUS USBHAL::endpointWriteResult(uint8_t endpoint) {
+    if ((endpoint >= NUMBER_OF_PHYSICAL_ENDPOINTS) || OUT_EP(endpoint)) {
+        return EP_INVALID;
+    }
+    Endpoint &e = controller.endpoints[endpoint];
+    if (e.buffer[0].active || e.buffer[1].active) {
+        return EP_PENDING;
+    }
+    if (e.stalled) {
+        return EP_STALLED;
+    }
+    return EP_COMPLETED;
+}
+
+void USBHAL::usbRamUsage(USB_RAM_USAGE *usage) {
+    memset(usage, 0, sizeof(*usage));
+    usage->size = usbRamSize;
+    usage->used = usbRamUsed();
+    usage->failed = usbRamFailed;
+}
+
+uint32_t USBHAL::endpointBufferAddress(uint8_t endpoint, uint8_t buffer) {
+    return 0;
+}
+
+void USBHAL::stallEndpoint(uint8_t endpoint) {
+    controller.endpoints[endpoint].stalled = true;
+}
+
+void USBHAL::unstallEndpoint(uint8_t endpoint) {
+    Endpoint &e = controller.endpoints[endpoint];
+    e.stalled = false;
+    e.buffer[0].active = false;
+    e.buffer[1].active = false;
+    e.next = e.inUse;
+}
+
+bool USBHAL::realiseEndpoint(uint8_t endpoint, uint32_t maxPacket, uint32_t options) {
+    if ((endpoint >= NUMBER_OF_PHYSICAL_ENDPOINTS) || (endpoint < 2) || (maxPacket > MAX_PACKET_SIZE_EP1)) {
+        return false;
+    }
+    Endpoint &e = controller.endpoints[endpoint];
+    const uint32_t ram = ((options & SINGLE_BUFFERED) ? 1 : 2) * ((maxPacket + 63) & ~63UL);
+    if (usbRamSize && (usbRamUsed() - e.ram + ram > usbRamSize)) {
+        usbRamFailed++;
+        return false;
+    }
+    e.ram = ram;
+    e.realised = true;
+    e.maxPacket = maxPacket;
+    e.doubleBuffered = !(options & SINGLE_BUFFERED);
+    unstallEndpoint(endpoint);
+    return true;
+}
+
+bool USBHAL::getEndpointStallState(unsigned char endpoint) {
+    return controller.endpoints[endpoint].stalled;
+}
+
+uint32_t USBHAL::endpointReadcore(uint8_t endpoint, uint8_t *buffer) {
+    return 0;
+}
+
+void USBHAL::_usbisr(void) {
+    instance->usbisr();
+}
+
+// same order of events as USBHAL_LPC11U.cpp
+void USBHAL::usbisr(void) {
+    if (controller.sof) {
+        controller.sof = false;
+        SOF(controller.frame);
+    }
+
+    if (controller.reset) {
+        controller.reset = false;
+        resetEndpoints();
+        busReset();
+    }
+
+    if (controller.setup) {
+        controller.setup = false;
+        controller.ep0out = false;
+        controller.ep0Stalled = false;
+        controller.ep0OutArmed = false;
+        controller.ep0InArmed = false;
+        EP0setupCallback();
+    } else if (controller.ep0out) {
+        controller.ep0out = false;
+        EP0out();
+    }
+
+    if (controller.ep0in) {
+        controller.ep0in = false;
+        EP0in();
+    }
+
+    for (uint8_t num = 2; num < NUMBER_OF_PHYSICAL_ENDPOINTS; num++) {
+        if (controller.ep & (1UL << num)) {
+            controller.ep &= ~(1UL << num);
+            endpointCompleted(num);
+            (instance->*(epCallback[num - 2]))();
+        }
+    }
+}
+
+
+namespace FakeUSBHost {
+
+int control(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, uint8_t* data, uint16_t length) {
+    const uint8_t packet[SETUP_PACKET_SIZE] = {
+        requestType, request,
+        (uint8_t)(value & 0xff), (uint8_t)(value >> 8),
+        (uint8_t)(index & 0xff), (uint8_t)(index >> 8),
+        (uint8_t)(length & 0xff), (uint8_t)(length >> 8),
+    };
+    memcpy(controller.setupPacket, packet, sizeof(packet));
+    controller.setup = true;
+    interrupt();
+
+    const bool in = requestType & 0x80;
+    uint16_t done = 0;
+    // data stage packets, then the status stage
+    for (int n = 0; n < 64; n++) {
+        if (controller.ep0Stalled) {
+            return -1;
+        }
+
+        if (!in && (done < length) && controller.ep0OutArmed) {
+            uint16_t size = length - done;
+            if (size > MAX_PACKET_SIZE_EP0) {
+                size = MAX_PACKET_SIZE_EP0;
+            }
+            memcpy(controller.ep0Out, data + done, size);
+            controller.ep0OutLength = size;
+            controller.ep0OutArmed = false;
+            done += size;
+            controller.ep0out = true;
+            interrupt();
+        } else if (controller.ep0InArmed) {
+            controller.ep0InArmed = false;
+            if (in) {
+                uint32_t size = controller.ep0InLength;
+                if (size > (uint32_t)(length - done)) {
+                    size = length - done;
+                }
+                memcpy(data + done, controller.ep0In, size);
+                done += size;
+            }
+            controller.ep0in = true;
+            interrupt();
+        } else {
+            break;
+        }
+    }
+    return controller.ep0Stalled ? -1 : done;
+}
+
+bool enumerate() {
+    busReset();
+    if (control(0x00, SET_ADDRESS, 1, 0, NULL, 0) < 0) {
+        return false;
+    }
+    return control(0x00, SET_CONFIGURATION, 1, 0, NULL, 0) >= 0;
+}
+
+void busReset() {
+    controller.reset = true;
+    interrupt();
+}
+
+void sof(uint16_t frame) {
+    controller.frame = frame & 0x7ff;
+    controller.sof = true;
+    interrupt();
+}
+
+int in(uint8_t endpoint, uint8_t* data) {
+    Endpoint &e = controller.endpoints[endpoint];
+    if (!e.realised || e.stalled) {
+        return -1;
+    }
+    Buffer &b = e.buffer[e.inUse];
+    if (!b.active) {
+        return -1;
+    }
+    const uint32_t length = b.length;
+    memcpy(data, b.data, length);
+    b.active = false;
+    if (e.doubleBuffered) {
+        e.inUse ^= 1;
+    }
+    controller.ep |= 1UL << endpoint;
+    interrupt();
+    return length;
+}
+
+bool out(uint8_t endpoint, const uint8_t* data, uint32_t length) {
+    Endpoint &e = controller.endpoints[endpoint];
+    if (!e.realised || e.stalled || !e.buffer[0].active || (length > e.maxPacket)) {
+        return false;
+    }
+    memcpy(e.buffer[0].data, data, length);
+    e.buffer[0].length = length;
+    e.buffer[0].active = false;
+    controller.ep |= 1UL << endpoint;
+    interrupt();
+    return true;
+}
+
+void usbRam(uint32_t size) {
+    usbRamSize = size;
+    usbRamFailed = 0;
+}
+
+uint8_t armed(uint8_t endpoint) {
+    Endpoint &e = controller.endpoints[endpoint];
+    return e.buffer[0].active + e.buffer[1].active;
+}
+
+bool connected() {
+    return controller.connected;
+}
+
+}
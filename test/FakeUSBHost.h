@@ -0,0 +1,53 @@
+#ifndef __FAKE_USB_HOST_H__
+#define __FAKE_USB_HOST_H__
+
+#include <stdint.h>
+
+/**
+ * USB host and LPC11U USB controller on Linux (FakeUSBHAL.cpp).
+ *
+ * The USBHAL of the device under test is backed by this fake instead of
+ * registers. Endpoints > 0 behave like the LPC11U: IN endpoints are double
+ * buffered unless SINGLE_BUFFERED, buffers are sent in the order they were
+ * armed, and endpointWriteResult() is PENDING while any buffer is active.
+ *
+ * Every host action runs the USB ISR of the device synchronously, as the
+ * controller interrupt would (SOF, bus reset, EP0, EPx completion).
+ */
+namespace FakeUSBHost {
+	/**
+	 * Control transfer. data: OUT data or buffer for IN data (length bytes).
+	 * Returns bytes of the IN data stage, or -1 when the device stalled.
+	 */
+	int control(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, uint8_t* data, uint16_t length);
+
+	// bus reset, SET_ADDRESS and SET_CONFIGURATION 1. false when the device stalled
+	bool enumerate();
+
+	void busReset();
+
+	// start of frame (11bit frame number)
+	void sof(uint16_t frame);
+
+	/**
+	 * IN token on a physical endpoint: takes the next armed buffer.
+	 * Returns its length, -1 when the endpoint NAKs (nothing armed) or is stalled.
+	 */
+	int in(uint8_t endpoint, uint8_t* data);
+
+	// OUT data on a physical endpoint. false when the endpoint NAKs
+	bool out(uint8_t endpoint, const uint8_t* data, uint32_t length);
+
+	/**
+	 * USB RAM for endpoint buffers in bytes (0: unlimited, the default).
+	 * realiseEndpoint() fails when the buffers do not fit.
+	 */
+	void usbRam(uint32_t size);
+
+	// IN buffers armed and not taken yet
+	uint8_t armed(uint8_t endpoint);
+
+	bool connected();
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef __HOST_KEYBOARD_H__
+#define __HOST_KEYBOARD_H__
+
+/**
+ * The firmware pipeline on Linux:
+ *
+ *   SimulatedKeyboardMatrix -> ScanProcessor (pack, debounce, Keymap)
+ *   -> MyUSBKeyboard on USBComposite -> FakeUSBHAL -> host
+ *
+ * Time moves in 1ms USB frames. Each frame has a SOF, a scan every
+ * scanPeriod frames (as ScanScheduler in fast mode), and the host IN token
+ * on the keyboard endpoint every USB_POLLING_INTERVAL_MS frames. Reports
+ * the host received are kept with their frame.
+ *
+ * Include mbed.h, config.h, USBComposite.h, MyUSBKeyboard.h and keymap.h
+ * (or a test keymap) before this.
+ */
+
+#include "SimulatedKeyboardMatrix.h"
+#include "Debouncer.h"
+#include "ScanProcessor.h"
+#include "FakeUSBHost.h"
+
+struct HostReport {
+	uint32_t frame;
+	uint8_t length;
+	uint8_t data[64];
+
+	// boot protocol report: modifier, reserved, keycode[6] without report ID
+	bool boot() const {
+		return length == 8;
+	}
+
+	// key code (or modifier 0xE0-0xE7) is down in this keyboard report
+	bool pressed(const uint8_t code) const {
+		if (boot()) return pressedIn(data, code);
+		switch (data[0]) {
+			case 4: // NKRO bitmap
+				return code < 0xE8 && (data[1 + (code >> 3)] & (1 << (code & 7)));
+			case 1: // 6KRO
+				return pressedIn(data + 1, code);
+		}
+		return false;
+	}
+
+	static bool pressedIn(const uint8_t* report, const uint8_t code) {
+		if (code >= 0xE0) return report[0] & (1 << (code - 0xE0));
+		for (int i = 2; i < 8; i++) {
+			if (report[i] == code) return true;
+		}
+		return false;
+	}
+
+	bool keyboard() const {
+		return boot() || data[0] == 1 || data[0] == 4;
+	}
+
+	// number of keys down (modifiers included)
+	int count() const {
+		int n = 0;
+		for (int code = 1; code < 0xE8; code++) {
+			if (pressed(code)) n++;
+		}
+		return n;
+	}
+};
+
+template <class DEBOUNCER = FilterDebouncer<ROWS, COLS> >
+class HostKeyboard {
+public:
+	static const int MAX_REPORTS = 1024;
+
+	USBComposite usb;
+	MyUSBKeyboard keyboard;
+	Keymap keymap;
+	SimulatedKeyboardMatrix matrix;
+	DEBOUNCER debouncer;
+	ScanProcessor<DEBOUNCER> processor;
+
+	HostReport reports[MAX_REPORTS];
+	int reportCount;
+
+	uint32_t frame;
+	uint32_t scanPeriod;
+	uint32_t scans;
+
+	HostKeyboard(const uint32_t _scanPeriod = 1) :
+		usb(0x1235, 0x0050, 0x0001),
+		keymap(keyboard),
+		matrix(COLS, _scanPeriod),
+		processor(debouncer, keymap, keyboard),
+		reportCount(0),
+		frame(0),
+		scanPeriod(_scanPeriod),
+		scans(0)
+	{
+		fakeTime() = 0;
+		usb.add(&keyboard);
+		usb.connect(false);
+		FakeUSBHost::enumerate();
+		matrix.init();
+	}
+
+	bool load(const char* script) {
+		return matrix.load(script);
+	}
+
+	// ms since start (simulated matrix clock follows scans)
+	uint32_t now() const {
+		return frame;
+	}
+
+	void step() {
+		frame++;
+		fakeTime() = frame * 1000;
+		FakeUSBHost::sof(frame);
+
+		if (frame % scanPeriod == 0) {
+			uint8_t keys[COLS];
+			keyboard.inputSampled();
+			matrix.scan(keys);
+			processor.process(keys, frame);
+			scans++;
+		}
+
+		if (frame % USB_POLLING_INTERVAL_MS == 0) {
+			poll();
+		}
+	}
+
+	// host IN token on the keyboard endpoint
+	bool poll() {
+		HostReport report;
+		const int length = FakeUSBHost::in(EPINT_IN, report.data);
+		if (length < 0) return false;
+		report.frame = frame;
+		report.length = length;
+		if (reportCount < MAX_REPORTS) reports[reportCount++] = report;
+		return true;
+	}
+
+	void run(const uint32_t frames) {
+		for (uint32_t i = 0; i < frames; i++) step();
+	}
+
+	// until the script is played and everything is sent
+	void runScript(const uint32_t settle = 300) {
+		while (!matrix.finished()) step();
+		run(settle);
+	}
+
+	/**
+	 * Keyboard reports which change the keys down, as the host sees key
+	 * events (consumer / system control reports and repeated reports skipped).
+	 */
+	int keyboardReports(const HostReport** out, const int max) const {
+		HostReport up;
+		memset(&up, 0, sizeof(up));
+		const HostReport* last = &up;
+		int n = 0;
+		for (int i = 0; i < reportCount && n < max; i++) {
+			if (!reports[i].keyboard()) continue;
+			bool changed = false;
+			for (int code = 1; code < 0xE8 && !changed; code++) {
+				changed = reports[i].pressed(code) != last->pressed(code);
+			}
+			last = &reports[i];
+			if (changed) out[n++] = &reports[i];
+		}
+		return n;
+	}
+
+	/**
+	 * Keys down in each report of keyboardReports() as text:
+	 * "04 04+16 -" (hex key codes, '-' all released)
+	 */
+	const char* keySequence() const {
+		static const HostReport* changes[MAX_REPORTS];
+		static char text[4096];
+		text[0] = 0;
+		const int n = keyboardReports(changes, MAX_REPORTS);
+		for (int i = 0; i < n; i++) {
+			char keys[128] = "-";
+			char* p = keys;
+			for (int code = 1; code < 0xE8 && p < keys + sizeof(keys) - 4; code++) {
+				if (changes[i]->pressed(code)) {
+					p += sprintf(p, p == keys ? "%02x" : "+%02x", code);
+				}
+			}
+			if (strlen(text) + strlen(keys) + 2 > sizeof(text)) break;
+			if (i) strcat(text, " ");
+			strcat(text, keys);
+		}
+		return text;
+	}
+};
+
+#endif
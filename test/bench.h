@@ -0,0 +1,43 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Minimal host microbenchmark.
+ *
+ *   struct Body { uint32_t run() { ...; return something; } };
+ *   Body body;
+ *   bench("name", body, 1000000);
+ *
+ * Prints ns per run() on the host CPU. Only the ratio between variants
+ * means something for the Cortex-M0; absolute numbers do not.
+ */
+inline uint64_t benchNanos() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// results of run() go here so that the work is not optimized away
+inline volatile uint32_t& benchSink() {
+	static volatile uint32_t sink = 0;
+	return sink;
+}
+
+template <class BODY>
+double bench(const char* name, BODY& body, const uint32_t iterations) {
+	// warm up caches and branch predictors
+	for (uint32_t i = 0; i < iterations / 10; i++) benchSink() += body.run();
+
+	const uint64_t start = benchNanos();
+	for (uint32_t i = 0; i < iterations; i++) benchSink() += body.run();
+	const double ns = static_cast<double>(benchNanos() - start) / iterations;
+
+	printf("  %-44s %9.1f ns\n", name, ns);
+	return ns;
+}
+
+#endif
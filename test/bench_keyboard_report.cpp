@@ -0,0 +1,98 @@
+/**
+ * Key events per second of the MyUSBKeyboard pressed key bitmap against
+ * the original 6 slot array under heavy rollover.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#include "bench.h"
+
+// rolling: press key n while keys n-1 .. n-held+1 are held, release n-held
+static int held;
+static const int KEYS = 24;
+
+// original appendReportData / deleteReportData (linear search and shift)
+struct SlotArray {
+	uint8_t modifier;
+	uint8_t keycode[6];
+
+	SlotArray() : modifier(0) {
+		memset(keycode, 0, sizeof(keycode));
+	}
+
+	void append(const uint8_t code) {
+		for (int i = 0; i < 6; i++) {
+			if (keycode[i] == 0) {
+				keycode[i] = code;
+				return;
+			}
+		}
+		for (int i = 0; i < 5; i++) {
+			keycode[i] = keycode[i+1];
+		}
+		keycode[5] = code;
+	}
+
+	void remove(const uint8_t code) {
+		uint8_t count = 0;
+		for (int i = 0; i < 6; i++) {
+			if (keycode[i]) count++;
+		}
+		for (int i = 0; i < 6; i++) {
+			if (keycode[i] == code) {
+				keycode[i] = 0;
+				count--;
+				for (int j = 0; j < 5-i; j++) {
+					keycode[i+j] = keycode[i+j+1];
+				}
+				for (int j = count; j < 6; j++) {
+					keycode[j] = 0;
+				}
+				return;
+			}
+		}
+	}
+};
+
+struct Original {
+	SlotArray slots;
+	int n;
+
+	Original() : n(0) {}
+
+	uint32_t run() {
+		slots.append(KEY_a_A + n % KEYS);
+		slots.remove(KEY_a_A + (n + KEYS - held) % KEYS);
+		n++;
+		return slots.keycode[0];
+	}
+};
+
+struct Bitmap {
+	MyUSBKeyboard keyboard;
+	int n;
+
+	Bitmap() : n(0) {}
+
+	uint32_t run() {
+		keyboard.appendReportData(KEY_a_A + n % KEYS);
+		keyboard.deleteReportData(KEY_a_A + (n + KEYS - held) % KEYS);
+		n++;
+		return n;
+	}
+};
+
+int main() {
+	static const int CASES[] = { 4, 8 };
+	for (unsigned i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++) {
+		held = CASES[i];
+		printf("press + release, %d keys held%s\n", held, held > 6 ? " (6KRO slots overflow)" : "");
+		Original original;
+		Bitmap bitmap;
+		const double a = bench("6 slot array (original)", original, 5000000);
+		const double b = bench("bitmap + slots (MyUSBKeyboard)", bitmap, 5000000);
+		printf("  %-44s %9.2fx\n", "ratio", a / b);
+	}
+	return 0;
+}
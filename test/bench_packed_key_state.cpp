@@ -0,0 +1,128 @@
+/**
+ * Debounce filter and change detection per scan: the 3-buffer byte per
+ * column filter of the original main.cpp vs PackedKeyState words.
+ */
+#include <string.h>
+#include "PackedKeyState.h"
+#include "bench.h"
+
+static const uint8_t ROWS = 8;
+static const uint8_t COLS = 16;
+static const int SCANS = 64;
+
+typedef PackedKeyState<ROWS, COLS> KeyState;
+
+// recorded-like scans: idle, or a few keys held with bounce on edges
+static uint8_t scans[SCANS][COLS];
+
+static void makeScans(const int keysDown) {
+	memset(scans, 0, sizeof(scans));
+	uint32_t seed = 12345;
+	for (int k = 0; k < keysDown; k++) {
+		seed = seed * 1103515245 + 12345;
+		const int col = (seed >> 8) % COLS;
+		const int row = (seed >> 16) % ROWS;
+		const int down = (seed >> 4) % (SCANS / 2);
+		const int up = down + 8 + (seed >> 20) % (SCANS / 2 - 8);
+		for (int s = down; s < up; s++) {
+			// one bouncing scan after press
+			if (s == down + 1) continue;
+			scans[s][col] |= 1 << row;
+		}
+	}
+}
+
+// original main.cpp: 3 scan buffers, filter and change per column byte
+struct ByteLayout {
+	uint8_t keys[3][COLS];
+	uint8_t keysLast[COLS];
+	int state;
+	int scan;
+
+	ByteLayout() : state(0), scan(0) {
+		memset(keys, 0, sizeof(keys));
+		memset(keysLast, 0, sizeof(keysLast));
+	}
+
+	uint32_t run() {
+		uint8_t* keysCurr = keys[state];
+		uint8_t* keysPrev = keys[(state + 2) % 3];
+		memcpy(keysCurr, scans[scan], COLS);
+		scan = (scan + 1) % SCANS;
+
+		uint32_t events = 0;
+		for (int col = 0; col < COLS; col++) {
+			const uint8_t filtered = (~(keysPrev[col] ^ keysCurr[col]) & keysCurr[col]);
+			const uint8_t changed = keysLast[col] ^ filtered;
+			keysLast[col] = filtered;
+			for (int row = 0; row < ROWS; row++) {
+				if (changed & (1<<row)) {
+					events += row * COLS + col + 1;
+				}
+			}
+		}
+		state = (state + 1) % 3;
+		return events;
+	}
+};
+
+// same filter on packed words, changed bits visited by count trailing zeros
+struct PackedLayout {
+	KeyState curr;
+	KeyState prev;
+	KeyState last;
+	int scan;
+
+	PackedLayout() : scan(0) {
+		curr.clear();
+		prev.clear();
+		last.clear();
+	}
+
+	uint32_t run() {
+		prev = curr;
+		curr.pack(scans[scan]);
+		scan = (scan + 1) % SCANS;
+
+		uint32_t events = 0;
+		for (int word = 0; word < KeyState::WORDS; word++) {
+			const uint32_t filtered = ~(prev.words[word] ^ curr.words[word]) & curr.words[word];
+			uint32_t changed = last.words[word] ^ filtered;
+			last.words[word] = filtered;
+			while (changed) {
+				const uint8_t bit = KeyState::countTrailingZeros(changed);
+				changed &= changed - 1;
+				const int index = word * 32 + bit;
+				events += (index / COLS) * COLS + index % COLS + 1;
+			}
+		}
+		return events;
+	}
+};
+
+int main() {
+	static const int CASES[] = { 0, 2, 10 };
+	int failures = 0;
+
+	printf("per scan, 8x16 matrix\n");
+	for (unsigned i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++) {
+		makeScans(CASES[i]);
+		printf(" %d keys pressed in %d scans\n", CASES[i], SCANS);
+
+		// both layouts must find the same events
+		ByteLayout byteCheck;
+		PackedLayout packedCheck;
+		for (int s = 0; s < SCANS * 2; s++) {
+			if (byteCheck.run() != packedCheck.run()) failures++;
+		}
+
+		ByteLayout byteLayout;
+		PackedLayout packedLayout;
+		const double bytes = bench("byte per column (3 buffers)", byteLayout, 2000000);
+		const double packed = bench("packed words + ctz", packedLayout, 2000000);
+		printf("  %-44s %9.2fx\n", "speedup", bytes / packed);
+	}
+
+	if (failures) printf("layouts disagree on %d scans\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * Word copying USBMemCopy against the original byte loop, for a setup
+ * packet, a full interrupt / bulk packet and a 512 byte transfer.
+ */
+#include <string.h>
+#include "USBMemCopy_LPC11U.h"
+#include "bench.h"
+
+// original USBMemCopy of USBHAL_LPC11U.cpp
+static void byteCopy(uint8_t *dst, uint8_t *src, uint32_t size) {
+	if (size > 0) {
+		do {
+			*dst++ = *src++;
+		} while (--size > 0);
+	}
+}
+
+// endpoint buffers in USB RAM are 64 byte aligned
+static uint8_t usbRam[512 + 64] __attribute__((aligned(64)));
+static uint8_t data[512 + 4] __attribute__((aligned(4)));
+
+struct Copy {
+	void (*copy)(uint8_t*, uint8_t*, uint32_t);
+	uint32_t size;
+	uint32_t offset;
+
+	Copy(void (*_copy)(uint8_t*, uint8_t*, uint32_t), const uint32_t _size, const uint32_t _offset) :
+		copy(_copy), size(_size), offset(_offset) {}
+
+	uint32_t run() {
+		copy(usbRam, data + offset, size);
+		return usbRam[size - 1];
+	}
+};
+
+int main() {
+	for (uint32_t i = 0; i < sizeof(data); i++) data[i] = i * 7;
+
+	// same result for every size and alignment
+	for (uint32_t offset = 0; offset < 4; offset++) {
+		for (uint32_t size = 0; size <= 512; size++) {
+			memset(usbRam, 0, sizeof(usbRam));
+			USBMemCopy(usbRam, data + offset, size);
+			if (memcmp(usbRam, data + offset, size) || usbRam[size]) {
+				printf("USBMemCopy differs: size %u offset %u\n", size, offset);
+				return 1;
+			}
+		}
+	}
+
+	static const uint32_t SIZES[] = { 8, 64, 512 };
+	for (unsigned i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++) {
+		const uint32_t size = SIZES[i];
+		const uint32_t iterations = 200000000 / (size + 16);
+		printf("%u bytes to USB RAM\n", size);
+		Copy bytes(byteCopy, size, 0);
+		Copy words(USBMemCopy, size, 0);
+		Copy unaligned(USBMemCopy, size, 1);
+		const double a = bench("byte loop (original)", bytes, iterations);
+		const double b = bench("USBMemCopy, word aligned", words, iterations);
+		bench("USBMemCopy, unaligned source", unaligned, iterations);
+		printf("  %-44s %9.2fx\n", "ratio", a / b);
+	}
+	return 0;
+}
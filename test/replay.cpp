@@ -0,0 +1,45 @@
+/**
+ * Plays a key event script (SimulatedKeyboardMatrix format) through the
+ * firmware pipeline and prints what the host received:
+ *
+ *   ./replay scripts/roll.txt [scanPeriod]
+ *
+ *   frame  report            keys
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#include "keymap.h"
+#include "HostKeyboard.h"
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s script [scanPeriod]\n", argv[0]);
+		return 2;
+	}
+	const uint32_t scanPeriod = argc > 2 ? atoi(argv[2]) : 1;
+
+	static HostKeyboard<> host(scanPeriod);
+	if (!host.matrix.loadFile(argv[1])) {
+		fprintf(stderr, "%s: cannot load\n", argv[1]);
+		return 1;
+	}
+	host.runScript();
+
+	for (int i = 0; i < host.reportCount; i++) {
+		const HostReport& r = host.reports[i];
+		printf("%6lu ", (unsigned long)r.frame);
+		for (int j = 0; j < r.length; j++) printf("%02x", r.data[j]);
+		if (r.keyboard()) {
+			printf("  [");
+			for (int code = 1; code < 0xE8; code++) {
+				if (r.pressed(code)) printf(" %02x", code);
+			}
+			printf(" ]");
+		}
+		printf("\n");
+	}
+	printf("# %lu scans, %d reports\n", (unsigned long)host.scans, host.reportCount);
+	return 0;
+}
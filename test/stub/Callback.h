@@ -0,0 +1,71 @@
+#ifndef MBED_CALLBACK_H
+#define MBED_CALLBACK_H
+
+#include <stddef.h>
+
+/**
+ * Host stand-in for mbed Callback: a function, or a member function
+ * bound to an object.
+ */
+template <typename F>
+class Callback;
+
+template <>
+class Callback<void()> {
+	struct Thunk {
+		virtual ~Thunk() {}
+		virtual void call() const = 0;
+		virtual Thunk* clone() const = 0;
+	};
+
+	template <typename T>
+	struct MethodThunk : Thunk {
+		T* object;
+		void (T::*method)();
+		MethodThunk(T* _object, void (T::*_method)()) : object(_object), method(_method) {}
+		virtual void call() const { (object->*method)(); }
+		virtual Thunk* clone() const { return new MethodThunk(object, method); }
+	};
+
+	void (*function)();
+	Thunk* thunk;
+
+public:
+	Callback(void (*_function)() = NULL) : function(_function), thunk(NULL) {}
+
+	template <typename T>
+	Callback(T* object, void (T::*method)()) : function(NULL), thunk(new MethodThunk<T>(object, method)) {}
+
+	Callback(const Callback& other) : function(other.function), thunk(other.thunk ? other.thunk->clone() : NULL) {}
+
+	Callback& operator=(const Callback& other) {
+		if (this != &other) {
+			delete thunk;
+			function = other.function;
+			thunk = other.thunk ? other.thunk->clone() : NULL;
+		}
+		return *this;
+	}
+
+	~Callback() {
+		delete thunk;
+	}
+
+	void call() const {
+		if (thunk) {
+			thunk->call();
+		} else if (function) {
+			function();
+		}
+	}
+
+	void operator()() const {
+		call();
+	}
+
+	operator bool() const {
+		return function || thunk;
+	}
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef MBED_STREAM_H
+#define MBED_STREAM_H
+
+#include <stdio.h>
+#include <stdarg.h>
+
+/**
+ * Host stand-in for mbed Stream: putc / getc / printf on _putc / _getc.
+ */
+class Stream {
+public:
+	virtual ~Stream() {}
+
+	int putc(int c) {
+		return _putc(c);
+	}
+
+	int getc() {
+		return _getc();
+	}
+
+	int printf(const char* format, ...) {
+		char text[256];
+		va_list args;
+		va_start(args, format);
+		const int n = vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		for (int i = 0; i < n && i < (int)sizeof(text) - 1; i++) {
+			_putc(text[i]);
+		}
+		return n;
+	}
+
+protected:
+	virtual int _putc(int c) = 0;
+	virtual int _getc() = 0;
+};
+
+#endif
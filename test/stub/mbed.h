@@ -0,0 +1,204 @@
+#ifndef MBED_H
+#define MBED_H
+
+/**
+ * Host (Linux) stand-in for the parts of mbed used by the firmware.
+ *
+ *   time      us_ticker_read() returns fakeTime(), moved by the tests
+ *   IRQ       PRIMASK / NVIC are plain variables, ISRs are called by the fakes
+ *   Ticker    handler kept, fired by the tests
+ *   I2C       blocking transfers on FakeI2CBus
+ *   Serial    printf to stdout
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "Callback.h"
+
+typedef enum {
+	USB_IRQn,
+	I2C_IRQn,
+	IRQ_COUNT
+} IRQn_Type;
+
+#define USB_IRQ USB_IRQn
+
+// us since start, set by the test (wraps like us_ticker)
+inline uint32_t& fakeTime() {
+	static uint32_t now = 0;
+	return now;
+}
+
+inline uint32_t us_ticker_read() {
+	return fakeTime();
+}
+
+inline void wait_us(int us) {
+	fakeTime() += us;
+}
+
+inline void wait_ms(int ms) {
+	fakeTime() += ms * 1000;
+}
+
+inline void wait(float s) {
+	fakeTime() += (uint32_t)(s * 1000000);
+}
+
+inline uint32_t& fakePrimask() {
+	static uint32_t primask = 0;
+	return primask;
+}
+
+inline uint32_t __get_PRIMASK() {
+	return fakePrimask();
+}
+
+inline void __set_PRIMASK(const uint32_t primask) {
+	fakePrimask() = primask;
+}
+
+inline void __disable_irq() {
+	fakePrimask() = 1;
+}
+
+inline void __enable_irq() {
+	fakePrimask() = 0;
+}
+
+inline bool& fakeIrqEnabled(const IRQn_Type irq) {
+	static bool enabled[IRQ_COUNT];
+	return enabled[irq];
+}
+
+inline void NVIC_EnableIRQ(const IRQn_Type irq) {
+	fakeIrqEnabled(irq) = true;
+}
+
+inline void NVIC_DisableIRQ(const IRQn_Type irq) {
+	fakeIrqEnabled(irq) = false;
+}
+
+// vectors are 32bit on the target; the fakes call the handlers directly
+#define NVIC_SetVector(irq, vector) ((void)(irq))
+
+inline void error(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	abort();
+}
+
+class Timer {
+	uint32_t started;
+	uint32_t elapsed;
+	bool running;
+
+public:
+	Timer() : started(0), elapsed(0), running(false) {}
+
+	void start() {
+		if (running) return;
+		started = us_ticker_read();
+		running = true;
+	}
+
+	void stop() {
+		if (!running) return;
+		elapsed += us_ticker_read() - started;
+		running = false;
+	}
+
+	void reset() {
+		started = us_ticker_read();
+		elapsed = 0;
+	}
+
+	int read_us() {
+		return elapsed + (running ? us_ticker_read() - started : 0);
+	}
+
+	int read_ms() {
+		return read_us() / 1000;
+	}
+};
+
+// attach_us() keeps the handler; tests call fire() instead of a timer IRQ
+class Ticker {
+	Callback<void()> handler;
+	uint32_t interval;
+
+public:
+	Ticker() : interval(0) {}
+
+	template <typename T>
+	void attach_us(T* object, void (T::*method)(), const uint32_t us) {
+		handler = Callback<void()>(object, method);
+		interval = us;
+	}
+
+	void detach() {
+		handler = Callback<void()>();
+		interval = 0;
+	}
+
+	bool attached() const {
+		return handler;
+	}
+
+	uint32_t intervalUs() const {
+		return interval;
+	}
+
+	void fire() {
+		handler.call();
+	}
+};
+
+class Timeout : public Ticker {
+};
+
+enum PinName {
+	UART_TX,
+	UART_RX,
+	NC
+};
+
+class Serial {
+public:
+	Serial(PinName, PinName) {}
+
+	int printf(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		const int n = vprintf(format, args);
+		va_end(args);
+		return n;
+	}
+};
+
+// LPC_I2C
+#include "FakeI2CBus.h"
+
+// blocking transfers on the fake bus
+class I2C {
+public:
+	I2C(PinName, PinName) {}
+
+	void frequency(int) {}
+
+	int write(int address, const char* data, int length, bool repeated = false) {
+		return FakeI2CBus::write(address, data, length, repeated);
+	}
+
+	int read(int address, char* data, int length, bool repeated = false) {
+		return FakeI2CBus::read(address, data, length, repeated);
+	}
+};
+
+#endif
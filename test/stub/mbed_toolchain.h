@@ -0,0 +1,6 @@
+#ifndef MBED_TOOLCHAIN_H
+#define MBED_TOOLCHAIN_H
+
+#define PACKED __attribute__((packed))
+
+#endif
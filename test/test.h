@@ -0,0 +1,81 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Minimal test runner for the host tests.
+ *
+ *   TEST(name) { CHECK(x); CHECK_EQ(a, b); }
+ *   int main() { return runTests(); }
+ */
+struct TestCase {
+	const char* name;
+	void (*function)();
+	TestCase* next;
+};
+
+inline TestCase*& testList() {
+	static TestCase* list = NULL;
+	return list;
+}
+
+inline int& testFailures() {
+	static int failures = 0;
+	return failures;
+}
+
+struct TestRegistration {
+	TestRegistration(TestCase* test) {
+		// keep the order of definition
+		TestCase** last = &testList();
+		while (*last) last = &(*last)->next;
+		*last = test;
+	}
+};
+
+#define TEST(name) \
+	static void name(); \
+	static TestCase name##_case = { #name, name, NULL }; \
+	static TestRegistration name##_registration(&name##_case); \
+	static void name()
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		testFailures()++; \
+	} \
+} while (0)
+
+#define CHECK_EQ(expected, actual) do { \
+	const long _e = (long)(expected); \
+	const long _a = (long)(actual); \
+	if (_e != _a) { \
+		printf("  %s:%d: CHECK_EQ(%s, %s) failed: %ld != %ld\n", __FILE__, __LINE__, #expected, #actual, _e, _a); \
+		testFailures()++; \
+	} \
+} while (0)
+
+#define CHECK_STR(expected, actual) do { \
+	const char* _e = (expected); \
+	const char* _a = (actual); \
+	if (strcmp(_e, _a) != 0) { \
+		printf("  %s:%d: CHECK_STR(%s, %s) failed:\n    expected: %s\n    actual:   %s\n", __FILE__, __LINE__, #expected, #actual, _e, _a); \
+		testFailures()++; \
+	} \
+} while (0)
+
+inline int runTests() {
+	int count = 0;
+	for (TestCase* test = testList(); test; test = test->next) {
+		const int before = testFailures();
+		test->function();
+		printf("%s %s\n", testFailures() == before ? "ok  " : "FAIL", test->name);
+		count++;
+	}
+	printf("%d tests, %d failures\n", count, testFailures());
+	return testFailures() ? 1 : 0;
+}
+
+#endif
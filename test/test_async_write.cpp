@@ -0,0 +1,116 @@
+/**
+ * USBDevice::writeAsync() on the double buffered IN endpoint of the fake
+ * controller: completions come in write order, each one reaching the
+ * endpoint callback and the function.
+ */
+#include "mbed.h"
+#include "USBComposite.h"
+#include "USBVendorFunction.h"
+#include "FakeUSBHost.h"
+#include "test.h"
+
+// completion events: 'w' endpoint callback, 's' USBVendorFunction::sent()
+static char events[64];
+
+static void event(const char e) {
+	const size_t n = strlen(events);
+	if (n < sizeof(events) - 1) {
+		events[n] = e;
+		events[n + 1] = 0;
+	}
+}
+
+static void written() {
+	event('w');
+}
+
+class TestFunction : public USBVendorFunction {
+public:
+	uint8_t in() const {
+		return endpointIn(0);
+	}
+
+protected:
+	virtual void sent() {
+		event('s');
+	}
+};
+
+struct Device {
+	USBComposite usb;
+	TestFunction function;
+
+	Device() : usb(0x1235, 0x0051, 0x0001) {
+		events[0] = 0;
+		usb.add(&function);
+		usb.connect(false);
+		FakeUSBHost::enumerate();
+		usb.attachWriteCallback(function.in(), written);
+	}
+
+	bool write(const char* text) {
+		return usb.writeAsync(function.in(), (uint8_t*)text, strlen(text), MAX_PACKET_SIZE_EPBULK);
+	}
+
+	// data of the next IN token as text, "NAK" when nothing armed
+	const char* in() {
+		static char text[MAX_PACKET_SIZE_EPBULK + 1];
+		const int length = FakeUSBHost::in(function.in(), (uint8_t*)text);
+		if (length < 0) return "NAK";
+		text[length] = 0;
+		return text;
+	}
+};
+
+TEST(completions_in_write_order) {
+	Device d;
+	CHECK(d.write("a"));
+	CHECK(d.write("b"));
+	// both buffers armed
+	CHECK(!d.write("c"));
+	CHECK_EQ(2, FakeUSBHost::armed(d.function.in()));
+
+	CHECK_STR("a", d.in());
+	CHECK_STR("ws", events);
+	// busy until the second buffer is taken too
+	CHECK(d.usb.writeBusy(d.function.in()));
+
+	CHECK_STR("b", d.in());
+	CHECK_STR("wsws", events);
+	CHECK(!d.usb.writeBusy(d.function.in()));
+	CHECK_STR("NAK", d.in());
+	CHECK_STR("wsws", events);
+}
+
+TEST(write_while_other_buffer_in_flight) {
+	Device d;
+	CHECK(d.write("a"));
+	CHECK(d.write("b"));
+	CHECK_STR("a", d.in());
+	// the freed buffer goes after the one in flight
+	CHECK(d.write("c"));
+	CHECK_STR("b", d.in());
+	CHECK_STR("c", d.in());
+	CHECK_STR("wswsws", events);
+	CHECK(!d.usb.writeBusy(d.function.in()));
+}
+
+TEST(detached_callback) {
+	Device d;
+	d.usb.attachWriteCallback(d.function.in(), Callback<void()>());
+	CHECK(d.write("a"));
+	CHECK_STR("a", d.in());
+	CHECK_STR("s", events);
+}
+
+TEST(not_configured) {
+	Device d;
+	FakeUSBHost::busReset();
+	CHECK(!d.write("a"));
+	CHECK(!d.usb.write(d.function.in(), (uint8_t*)"a", 1, MAX_PACKET_SIZE_EPBULK));
+	CHECK_STR("NAK", d.in());
+}
+
+int main() {
+	return runTests();
+}
@@ -0,0 +1,78 @@
+/**
+ * USBCDCFunction bulk IN on the fake controller: output is split into
+ * packets, and a transfer ending on a full packet gets a zero length one.
+ */
+#include "mbed.h"
+#include "USBComposite.h"
+#include "USBCDCFunction.h"
+#include "FakeUSBHost.h"
+#include "test.h"
+
+#define CDC_SET_CONTROL_LINE_STATE 0x22
+
+class TestConsole : public USBCDCFunction {
+public:
+	uint8_t dataIn() const {
+		return endpointIn(1);
+	}
+};
+
+struct Device {
+	USBComposite usb;
+	TestConsole console;
+
+	Device() : usb(0x1235, 0x0052, 0x0001) {
+		usb.add(&console);
+		usb.connect(false);
+		FakeUSBHost::enumerate();
+		// terminal opened (DTR)
+		FakeUSBHost::control(0x21, CDC_SET_CONTROL_LINE_STATE, 1, 0, NULL, 0);
+	}
+
+	uint16_t write(const uint16_t size) {
+		uint8_t data[512];
+		for (uint16_t i = 0; i < size; i++) data[i] = i;
+		return console.write(data, size);
+	}
+
+	// lengths of the packets the host reads until NAK: "64 64 0"
+	const char* packets() {
+		static char text[256];
+		char* p = text;
+		text[0] = 0;
+		uint8_t data[MAX_PACKET_SIZE_EPBULK];
+		int length;
+		while ((length = FakeUSBHost::in(console.dataIn(), data)) >= 0 && p < text + sizeof(text) - 8) {
+			p += sprintf(p, p == text ? "%d" : " %d", length);
+		}
+		return text;
+	}
+};
+
+TEST(short_packet_ends_transfer) {
+	Device d;
+	CHECK_EQ(10, d.write(10));
+	CHECK_STR("10", d.packets());
+	CHECK_EQ(100, d.write(100));
+	CHECK_STR("64 36", d.packets());
+}
+
+TEST(full_packet_followed_by_zlp) {
+	Device d;
+	CHECK_EQ(64, d.write(64));
+	CHECK_STR("64 0", d.packets());
+	CHECK_EQ(192, d.write(192));
+	CHECK_STR("64 64 64 0", d.packets());
+	CHECK_STR("", d.packets());
+}
+
+TEST(no_output_without_terminal) {
+	Device d;
+	FakeUSBHost::control(0x21, CDC_SET_CONTROL_LINE_STATE, 0, 0, NULL, 0);
+	CHECK_EQ(0, d.write(10));
+	CHECK_STR("", d.packets());
+}
+
+int main() {
+	return runTests();
+}
@@ -0,0 +1,138 @@
+/**
+ * Debouncers against bounce traces (traces/) scanned every 1ms:
+ * press / release latency and chatter (extra or missing presses).
+ */
+#include "Debouncer.h"
+#include "SimulatedKeyboardMatrix.h"
+#include "test.h"
+
+static const uint8_t ROWS = 8;
+static const uint8_t COLS = 16;
+static const uint16_t RELEASE_MS = 5;
+
+typedef PackedKeyState<ROWS, COLS> KeyState;
+
+struct Trace {
+	const char* file;
+	// edges of the switch (first contact, first open), 0: none
+	int presses;
+	uint32_t press[2];
+	uint32_t release[2];
+};
+
+static const Trace TRACES[] = {
+	{ "traces/clean.txt", 1, { 10 }, { 60 } },
+	{ "traces/press_bounce.txt", 1, { 10 }, { 80 } },
+	{ "traces/release_bounce.txt", 1, { 10 }, { 80 } },
+	{ "traces/both_bounce.txt", 1, { 10 }, { 90 } },
+	{ "traces/fast_repeat.txt", 2, { 10, 50 }, { 30, 70 } },
+	{ "traces/glitch.txt", 0, { 0 }, { 0 } },
+};
+static const int TRACE_COUNT = sizeof(TRACES) / sizeof(TRACES[0]);
+
+struct Result {
+	int presses;
+	int releases;
+	uint32_t press[8];
+	uint32_t release[8];
+};
+
+static Result play(Debouncer<ROWS, COLS>& debouncer, const char* file) {
+	Result result;
+	memset(&result, 0, sizeof(result));
+
+	SimulatedKeyboardMatrix matrix(COLS);
+	if (!matrix.loadFile(file)) {
+		printf("  %s: cannot load\n", file);
+		testFailures()++;
+		return result;
+	}
+
+	uint8_t keys[COLS];
+	KeyState raw;
+	KeyState changed;
+	for (int scan = 0; scan < 200; scan++) {
+		matrix.scan(keys);
+		raw.pack(keys);
+		debouncer.update(raw, matrix.time(), changed);
+		if (!(changed.words[0] & 1)) continue;
+		if (debouncer.state().words[0] & 1) {
+			if (result.presses < 8) result.press[result.presses] = matrix.time();
+			result.presses++;
+		} else {
+			if (result.releases < 8) result.release[result.releases] = matrix.time();
+			result.releases++;
+		}
+	}
+	return result;
+}
+
+/**
+ * Plays every trace, prints latency and checks against the limits.
+ * presses: debounced presses expected for each trace (chatter included)
+ * maxPressLatency / maxReleaseLatency: ms from the switch edge
+ */
+template <class DEBOUNCER>
+static void checkTraces(const char* name, const int (&presses)[TRACE_COUNT], const uint32_t maxPressLatency, const uint32_t maxReleaseLatency) {
+	printf("  %s\n", name);
+	for (int i = 0; i < TRACE_COUNT; i++) {
+		const Trace& trace = TRACES[i];
+		DEBOUNCER debouncer;
+		const Result result = play(debouncer, trace.file);
+
+		printf("    %-28s presses=%d", trace.file, result.presses);
+		CHECK_EQ(presses[i], result.presses);
+		CHECK_EQ(result.presses, result.releases);
+
+		// latency of chattering or missed keys means nothing
+		if (result.presses == trace.presses) {
+			for (int n = 0; n < trace.presses; n++) {
+				const uint32_t pressLatency = result.press[n] - trace.press[n];
+				const uint32_t releaseLatency = result.release[n] - trace.release[n];
+				printf(" press+%lums release+%lums", (unsigned long)pressLatency, (unsigned long)releaseLatency);
+				CHECK(pressLatency <= maxPressLatency);
+				CHECK(releaseLatency <= maxReleaseLatency);
+			}
+		}
+		printf("\n");
+	}
+}
+
+/**
+ * Press after 2 agreeing scans, so press bounce adds its length.
+ * Release is taken at once: contact for 2 scans in release bounce is
+ * another press (chatter).
+ */
+TEST(filter) {
+	static const int presses[TRACE_COUNT] = { 1, 1, 2, 3, 2, 0 };
+	checkTraces<FilterDebouncer<ROWS, COLS> >("FilterDebouncer", presses, 5, 0);
+}
+
+struct Eager : public EagerDebouncer<ROWS, COLS> {
+	Eager() : EagerDebouncer<ROWS, COLS>(RELEASE_MS) {}
+};
+
+// no press latency and no chatter, but noise is a press too
+TEST(eager) {
+	static const int presses[TRACE_COUNT] = { 1, 1, 1, 1, 2, 1 };
+	checkTraces<Eager>("EagerDebouncer", presses, 0, 5 + RELEASE_MS);
+}
+
+// 4 agreeing scans on both edges
+TEST(counter) {
+	static const int presses[TRACE_COUNT] = { 1, 1, 1, 1, 2, 0 };
+	checkTraces<CounterDebouncer<ROWS, COLS> >("CounterDebouncer", presses, 3 + 6, 3 + 5);
+}
+
+TEST(eager_press_is_immediate) {
+	Eager debouncer;
+	const Result result = play(debouncer, "traces/press_bounce.txt");
+	CHECK_EQ(1, result.presses);
+	CHECK_EQ(10, result.press[0]);
+	// last contact read at 79, released RELEASE_MS after it
+	CHECK_EQ(79 + RELEASE_MS, result.release[0]);
+}
+
+int main() {
+	return runTests();
+}
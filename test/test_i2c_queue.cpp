@@ -0,0 +1,180 @@
+/**
+ * I2CTransactionQueue state machine on the fake LPC11U I2C master.
+ */
+#include "mbed.h"
+#include "I2CTransactionQueue.h"
+#include "test.h"
+
+static const uint8_t EXPANDER = 0x20;
+static const uint8_t MISSING = 0x21;
+
+static int completed;
+static int8_t statuses[64];
+
+static void record(void*, const I2CTransaction& transaction) {
+	statuses[completed++ % 64] = transaction.status;
+}
+
+static void setup() {
+	FakeI2CBus::reset();
+	FakeI2CBus::attach(EXPANDER);
+	completed = 0;
+	memset(statuses, 0, sizeof(statuses));
+}
+
+static I2CTransaction* queueWrite(I2CTransactionQueue& queue, const uint8_t address, const uint8_t reg, const uint8_t value) {
+	I2CTransaction* t = queue.reserve();
+	if (!t) return NULL;
+	t->address = address << 1;
+	t->txLength = 2;
+	t->tx[0] = reg;
+	t->tx[1] = value;
+	t->callback = record;
+	queue.commit();
+	return t;
+}
+
+static I2CTransaction* queueRead(I2CTransactionQueue& queue, const uint8_t address, const uint8_t reg, const uint8_t length) {
+	I2CTransaction* t = queue.reserve();
+	if (!t) return NULL;
+	t->address = address << 1;
+	t->txLength = 1;
+	t->tx[0] = reg;
+	t->rxLength = length;
+	t->callback = record;
+	queue.commit();
+	return t;
+}
+
+TEST(register_write) {
+	setup();
+	I2CTransactionQueue queue;
+	queueWrite(queue, EXPANDER, 0x12, 0x34);
+	CHECK(!queue.idle());
+	CHECK(fakeIrqEnabled(I2C_IRQn));
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	CHECK_STR("S W20 A 12 A 34 A P", FakeI2CBus::trace());
+	CHECK_EQ(0x34, FakeI2CBus::reg(EXPANDER, 0x12));
+	CHECK_EQ(1, completed);
+	CHECK_EQ(0, statuses[0]);
+	CHECK(queue.idle());
+	CHECK(!fakeIrqEnabled(I2C_IRQn));
+}
+
+TEST(single_byte_read_with_repeated_start) {
+	setup();
+	FakeI2CBus::reg(EXPANDER, 0x13) = 0x55;
+	I2CTransactionQueue queue;
+	I2CTransaction* t = queueRead(queue, EXPANDER, 0x13, 1);
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	// the only byte is NACKed by the master
+	CHECK_STR("S W20 A 13 A Sr R20 A r55 N P", FakeI2CBus::trace());
+	CHECK_EQ(0x55, t->rx[0]);
+	CHECK_EQ(0, t->status);
+	CHECK(queue.idle());
+}
+
+TEST(two_byte_read) {
+	setup();
+	FakeI2CBus::reg(EXPANDER, 0x12) = 0x55;
+	FakeI2CBus::reg(EXPANDER, 0x13) = 0x66;
+	I2CTransactionQueue queue;
+	I2CTransaction* t = queueRead(queue, EXPANDER, 0x12, 2);
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	CHECK_STR("S W20 A 12 A Sr R20 A r55 A r66 N P", FakeI2CBus::trace());
+	CHECK_EQ(0x55, t->rx[0]);
+	CHECK_EQ(0x66, t->rx[1]);
+	CHECK_EQ(0, t->status);
+}
+
+TEST(address_nak_fails_and_queue_continues) {
+	setup();
+	FakeI2CBus::reg(EXPANDER, 0x13) = 0x55;
+	I2CTransactionQueue queue;
+	queueWrite(queue, MISSING, 0x12, 0x34);
+	I2CTransaction* t = queueRead(queue, EXPANDER, 0x13, 1);
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	// STOP and the next START are issued at once
+	CHECK_STR("S W21 N P S W20 A 13 A Sr R20 A r55 N P", FakeI2CBus::trace());
+	CHECK_EQ(2, completed);
+	CHECK_EQ(-1, statuses[0]);
+	CHECK_EQ(0, statuses[1]);
+	CHECK_EQ(0x55, t->rx[0]);
+	CHECK(queue.idle());
+}
+
+TEST(data_nak_fails) {
+	setup();
+	FakeI2CBus::nakData(EXPANDER, true);
+	I2CTransactionQueue queue;
+	queueWrite(queue, EXPANDER, 0x12, 0x34);
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	CHECK_STR("S W20 A 12 N P", FakeI2CBus::trace());
+	CHECK_EQ(1, completed);
+	CHECK_EQ(-1, statuses[0]);
+	CHECK(queue.idle());
+	CHECK(!fakeIrqEnabled(I2C_IRQn));
+}
+
+TEST(ring_full) {
+	setup();
+	I2CTransactionQueue queue;
+	// ISR does not run: everything stays queued
+	int queued = 0;
+	while (queueWrite(queue, EXPANDER, queued & 31, queued)) queued++;
+	CHECK_EQ(31, queued);
+	CHECK_EQ(0, queue.available());
+	CHECK(queue.reserve() == NULL);
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	CHECK_EQ(31, completed);
+	CHECK_EQ(31, queue.available());
+	CHECK_EQ(30, FakeI2CBus::reg(EXPANDER, 30));
+	CHECK(queue.idle());
+}
+
+static I2CTransactionQueue* chained;
+
+static void chain(void* context, const I2CTransaction& transaction);
+
+// write register n (n: completed transactions) until 3 are written
+static void chainNext() {
+	if (completed >= 3) return;
+	I2CTransaction* t = chained->reserve();
+	t->address = EXPANDER << 1;
+	t->txLength = 2;
+	t->tx[0] = completed;
+	t->tx[1] = 0xA0 + completed;
+	t->callback = chain;
+	chained->commit();
+}
+
+// queues the next one from ISR
+static void chain(void* context, const I2CTransaction& transaction) {
+	record(context, transaction);
+	chainNext();
+}
+
+TEST(callback_chains_transactions) {
+	setup();
+	I2CTransactionQueue queue;
+	chained = &queue;
+	chainNext();
+
+	FakeI2CBus::run(I2CTransactionQueue::irq);
+	CHECK_STR("S W20 A 00 A a0 A P S W20 A 01 A a1 A P S W20 A 02 A a2 A P", FakeI2CBus::trace());
+	CHECK_EQ(3, completed);
+	CHECK_EQ(0xA0, FakeI2CBus::reg(EXPANDER, 0));
+	CHECK_EQ(0xA1, FakeI2CBus::reg(EXPANDER, 1));
+	CHECK_EQ(0xA2, FakeI2CBus::reg(EXPANDER, 2));
+	CHECK(queue.idle());
+}
+
+int main() {
+	return runTests();
+}
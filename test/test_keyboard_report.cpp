@@ -0,0 +1,183 @@
+/**
+ * MyUSBKeyboard key state to reports: 6KRO slots, NKRO bitmap and boot
+ * protocol as the host receives them.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#include "keymap.h"
+#include "HostKeyboard.h"
+#include "test.h"
+
+static const uint8_t KEYS[] = { KEY_a_A, KEY_b_B, KEY_c_C, KEY_d_D, KEY_e_E, KEY_f_F, KEY_g_G, KEY_h_H };
+
+static bool setBootProtocol() {
+	// SET_PROTOCOL(boot) to interface 0
+	return FakeUSBHost::control(0x21, SET_PROTOCOL, HID_BOOT_PROTOCOL, 0, NULL, 0) >= 0;
+}
+
+// last keyboard report the host got after the state is sent
+static const HostReport& send(HostKeyboard<>& host) {
+	CHECK(host.keyboard.queueCurrentReportData());
+	host.run(10);
+	for (int i = host.reportCount - 1; i >= 0; i--) {
+		if (host.reports[i].keyboard()) return host.reports[i];
+	}
+	static HostReport none;
+	return none;
+}
+
+// boot report slots holding code
+static int slots(const HostReport& report, const uint8_t code) {
+	int n = 0;
+	for (int i = 2; i < 8; i++) {
+		if (report.data[i] == code) n++;
+	}
+	return n;
+}
+
+TEST(nkro_reports_every_key) {
+	HostKeyboard<> host;
+	for (int i = 0; i < 8; i++) host.keyboard.appendReportData(KEYS[i]);
+	host.keyboard.appendReportData(KEY_LeftShift);
+	const HostReport& all = send(host);
+	CHECK(!all.boot());
+	CHECK_EQ(9, all.count());
+	CHECK(all.pressed(KEY_LeftShift));
+
+	for (int i = 0; i < 8; i++) host.keyboard.deleteReportData(KEYS[i]);
+	const HostReport& shift = send(host);
+	CHECK_EQ(1, shift.count());
+	CHECK(shift.pressed(KEY_LeftShift));
+}
+
+TEST(boot_protocol_sends_boot_report) {
+	HostKeyboard<> host;
+	CHECK(setBootProtocol());
+	uint8_t protocol = 0xff;
+	CHECK_EQ(1, FakeUSBHost::control(0xa1, GET_PROTOCOL, 0, 0, &protocol, 1));
+	CHECK_EQ(HID_BOOT_PROTOCOL, protocol);
+
+	host.keyboard.appendReportData(KEY_LeftShift);
+	host.keyboard.appendReportData(KEY_a_A);
+	const HostReport& report = send(host);
+	CHECK(report.boot());
+	CHECK(report.pressed(KEY_LeftShift));
+	CHECK(report.pressed(KEY_a_A));
+	CHECK_EQ(2, report.count());
+}
+
+TEST(set_configuration_returns_to_report_protocol) {
+	HostKeyboard<> host;
+	CHECK(setBootProtocol());
+	CHECK(FakeUSBHost::control(0x00, SET_CONFIGURATION, 1, 0, NULL, 0) >= 0);
+	host.keyboard.appendReportData(KEY_a_A);
+	const HostReport& report = send(host);
+	CHECK(!report.boot());
+	CHECK(report.pressed(KEY_a_A));
+}
+
+TEST(boot_press_release_press_before_report) {
+	HostKeyboard<> host;
+	CHECK(setBootProtocol());
+	host.keyboard.appendReportData(KEY_a_A);
+	host.keyboard.deleteReportData(KEY_a_A);
+	host.keyboard.appendReportData(KEY_a_A);
+	const HostReport& down = send(host);
+	CHECK(down.boot());
+	CHECK_EQ(1, slots(down, KEY_a_A));
+
+	host.keyboard.deleteReportData(KEY_a_A);
+	CHECK_EQ(0, send(host).count());
+}
+
+TEST(boot_overflow_refills_evicted_key) {
+	HostKeyboard<> host;
+	CHECK(setBootProtocol());
+	for (int i = 0; i < 7; i++) host.keyboard.appendReportData(KEYS[i]);
+	const HostReport& full = send(host);
+	// first key evicted for the 7th
+	CHECK_EQ(6, full.count());
+	CHECK(!full.pressed(KEYS[0]));
+	CHECK(full.pressed(KEYS[6]));
+
+	host.keyboard.deleteReportData(KEYS[3]);
+	const HostReport& refilled = send(host);
+	CHECK_EQ(6, refilled.count());
+	CHECK(refilled.pressed(KEYS[0]));
+	CHECK(!refilled.pressed(KEYS[3]));
+}
+
+TEST(nkro_keeps_slots_for_boot_protocol) {
+	HostKeyboard<> host;
+	// report protocol (NKRO): slots must follow without being reported
+	for (int i = 0; i < 8; i++) host.keyboard.appendReportData(KEYS[i]);
+	const HostReport& all = send(host);
+	CHECK(!all.boot());
+	CHECK_EQ(8, all.count());
+
+	for (int i = 0; i < 5; i++) host.keyboard.deleteReportData(KEYS[i]);
+	host.keyboard.appendReportData(KEYS[1]);
+	host.keyboard.deleteReportData(KEYS[1]);
+	host.keyboard.appendReportData(KEYS[1]);
+	CHECK_EQ(4, send(host).count());
+
+	// BIOS switches to boot protocol: exactly the keys still down
+	CHECK(setBootProtocol());
+	const HostReport& boot = send(host);
+	CHECK(boot.boot());
+	CHECK_EQ(4, boot.count());
+	CHECK_EQ(1, slots(boot, KEYS[1]));
+	for (int i = 5; i < 8; i++) CHECK_EQ(1, slots(boot, KEYS[i]));
+}
+
+TEST(same_key_on_two_positions) {
+	HostKeyboard<> host;
+	host.keyboard.appendReportData(KEY_a_A);
+	host.keyboard.appendReportData(KEY_a_A);
+	host.keyboard.deleteReportData(KEY_a_A);
+	// still held on the other position
+	CHECK(send(host).pressed(KEY_a_A));
+	host.keyboard.deleteReportData(KEY_a_A);
+	CHECK(!send(host).pressed(KEY_a_A));
+}
+
+TEST(modifiers_are_not_slots) {
+	HostKeyboard<> host;
+	CHECK(setBootProtocol());
+	host.keyboard.appendReportData(KEY_LeftShift);
+	for (int i = 0; i < 6; i++) host.keyboard.appendReportData(KEYS[i]);
+	const HostReport& report = send(host);
+	CHECK(report.pressed(KEY_LeftShift));
+	CHECK_EQ(7, report.count());
+}
+
+TEST(changes_while_in_flight_keep_their_order) {
+	HostKeyboard<> host;
+	send(host);
+	host.reportCount = 0;
+	for (int i = 0; i < 3; i++) {
+		host.keyboard.appendReportData(KEYS[i]);
+		CHECK(host.keyboard.queueCurrentReportData());
+	}
+	host.run(10);
+	// a report per change behind the one on the endpoint
+	CHECK_EQ(3, host.reportCount);
+	for (int i = 0; i < 3; i++) CHECK_EQ(i + 1, host.reports[i].count());
+}
+
+TEST(identical_report_is_skipped) {
+	HostKeyboard<> host;
+	host.keyboard.appendReportData(KEY_a_A);
+	send(host);
+	const int sent = host.reportCount;
+	host.keyboard.deleteReportData(KEY_a_A);
+	host.keyboard.appendReportData(KEY_a_A);
+	send(host);
+	CHECK_EQ(sent, host.reportCount);
+}
+
+int main() {
+	return runTests();
+}
@@ -0,0 +1,223 @@
+/**
+ * LayerStack transitions, and layers through Keymap and the host harness.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#define KEYMAP_DEFINITION_EXTERNAL
+#include "keymap.h"
+#include "HostKeyboard.h"
+#include "test.h"
+
+// row 0: MO(1), TG(1), OSL(1), DF(1), a, s, AC Home
+// layer 1: DF(0), b, trans, AL Calculator
+const keyaction_t Keymap::KEYMAP_DEFINITION[LAYERS][ROWS][COLS] = {
+	{
+		{ MO(1), TG(1), OSL(1), DF(1), _A, _S, CONSUMER(CONSUMER_AC_HOME) },
+	},
+	{
+		{ KEY_ACTION_TRANSPARENT, KEY_ACTION_TRANSPARENT, KEY_ACTION_TRANSPARENT, DF(0), _B, KEY_ACTION_TRANSPARENT, CONSUMER(CONSUMER_AL_CALCULATOR) },
+	},
+};
+
+TEST(default_layer_only) {
+	LayerStack layers;
+	CHECK_EQ(1, layers.state());
+	CHECK_EQ(0, layers.highest());
+	CHECK(layers.isActive(0));
+	CHECK(!layers.isActive(1));
+}
+
+TEST(momentary_on_off) {
+	LayerStack layers;
+	layers.on(3);
+	CHECK_EQ(0x9, layers.state());
+	CHECK_EQ(3, layers.highest());
+	layers.off(3);
+	CHECK_EQ(1, layers.state());
+}
+
+TEST(highest_of_several) {
+	LayerStack layers;
+	layers.on(2);
+	layers.on(31);
+	layers.on(5);
+	CHECK_EQ(31, layers.highest());
+	layers.off(31);
+	CHECK_EQ(5, layers.highest());
+}
+
+TEST(toggle_twice) {
+	LayerStack layers;
+	layers.toggle(1);
+	CHECK(layers.isActive(1));
+	layers.toggle(1);
+	CHECK(!layers.isActive(1));
+}
+
+TEST(default_layer_change) {
+	LayerStack layers;
+	layers.setDefault(2);
+	CHECK(!layers.isActive(0));
+	CHECK(layers.isActive(2));
+	CHECK_EQ(2, layers.highest());
+	// a momentary layer below the default one does not win
+	layers.on(1);
+	CHECK_EQ(2, layers.highest());
+	// off() of the default layer leaves it active
+	layers.off(2);
+	CHECK(layers.isActive(2));
+}
+
+TEST(one_shot_for_next_key) {
+	LayerStack layers;
+	layers.oneShotPress(1);
+	layers.oneShotRelease(1);
+	// still active after its key is released
+	CHECK(layers.isActive(1));
+	layers.keyPressed();
+	CHECK(!layers.isActive(1));
+}
+
+TEST(one_shot_held_is_momentary) {
+	LayerStack layers;
+	layers.oneShotPress(1);
+	layers.keyPressed();
+	layers.keyPressed();
+	// used while held: stays until release
+	CHECK(layers.isActive(1));
+	layers.oneShotRelease(1);
+	CHECK(!layers.isActive(1));
+}
+
+TEST(one_shot_release_without_press_is_ignored) {
+	LayerStack layers;
+	layers.on(1);
+	layers.oneShotRelease(1);
+	CHECK(layers.isActive(1));
+}
+
+TEST(one_shot_pressed_again_restarts) {
+	LayerStack layers;
+	layers.oneShotPress(1);
+	layers.oneShotRelease(1);
+	layers.oneShotPress(1);
+	layers.keyPressed();
+	// held again: not ended by the key press
+	CHECK(layers.isActive(1));
+	layers.oneShotRelease(1);
+	CHECK(!layers.isActive(1));
+}
+
+static HostKeyboard<>* host;
+
+static const char* play(const char* script) {
+	delete host;
+	host = new HostKeyboard<>();
+	host->load(script);
+	host->runScript();
+	return host->keySequence();
+}
+
+// usages of the Consumer Control reports of the last play() as text: "223 0"
+static const char* consumerUsages() {
+	static char text[256];
+	char* p = text;
+	text[0] = 0;
+	for (int i = 0; i < host->reportCount && p < text + sizeof(text) - 8; i++) {
+		const HostReport& r = host->reports[i];
+		if (r.keyboard() || r.data[0] != 3) continue; // REPORT_ID_CONSUMER
+		// the empty report sent once after configuration
+		if (p == text && !r.data[1] && !r.data[2]) continue;
+		p += sprintf(p, p == text ? "%x" : " %x", r.data[1] | (r.data[2] << 8));
+	}
+	return text;
+}
+
+TEST(release_uses_action_of_press) {
+	// MO released before b: b (not a) is released
+	CHECK_STR("05 -", play(
+		"10  0 0 d\n"
+		"30  0 4 d\n"
+		"50  0 0 u\n"
+		"70  0 4 u\n"
+	));
+}
+
+TEST(transparent_falls_through) {
+	CHECK_STR("16 -", play(
+		"10  0 0 d\n"
+		"30  0 5 d\n"
+		"50  0 5 u\n"
+		"70  0 0 u\n"
+	));
+}
+
+TEST(toggle_layer) {
+	CHECK_STR("05 - 04 -", play(
+		"10  0 1 d\n"
+		"20  0 1 u\n"
+		"30  0 4 d\n"
+		"40  0 4 u\n"
+		"50  0 1 d\n"
+		"60  0 1 u\n"
+		"70  0 4 d\n"
+		"80  0 4 u\n"
+	));
+}
+
+TEST(one_shot_layer) {
+	CHECK_STR("05 - 04 -", play(
+		"10  0 2 d\n"
+		"20  0 2 u\n"
+		"30  0 4 d\n"
+		"40  0 4 u\n"
+		"50  0 4 d\n"
+		"60  0 4 u\n"
+	));
+}
+
+TEST(one_shot_layer_held) {
+	CHECK_STR("05 - 05 - 04 -", play(
+		"10  0 2 d\n"
+		"30  0 4 d\n"
+		"40  0 4 u\n"
+		"50  0 4 d\n"
+		"60  0 4 u\n"
+		"70  0 2 u\n"
+		"80  0 4 d\n"
+		"90  0 4 u\n"
+	));
+}
+
+TEST(default_layer_switch) {
+	CHECK_STR("05 - 04 -", play(
+		"10  0 3 d\n"
+		"20  0 3 u\n"
+		"30  0 4 d\n"
+		"40  0 4 u\n"
+		"50  0 3 d\n"
+		"60  0 3 u\n"
+		"70  0 4 d\n"
+		"80  0 4 u\n"
+	));
+}
+
+TEST(consumer_usage_above_0xff) {
+	CHECK_EQ(CONSUMER_AC_HOME, KEY_ACTION_CONSUMER_USAGE(CONSUMER(CONSUMER_AC_HOME)));
+	CHECK_STR("", play(
+		"10  0 6 d\n"
+		"30  0 6 u\n"
+		"50  0 0 d\n"
+		"60  0 6 d\n"
+		"70  0 0 u\n"
+		"80  0 6 u\n"
+	));
+	// released with the action of the press, after MO is released
+	CHECK_STR("223 0 192 0", consumerUsages());
+}
+
+int main() {
+	return runTests();
+}
@@ -0,0 +1,159 @@
+/**
+ * KeyboardMatrixController on two MCP23017 of the fake bus: setup through
+ * blocking I2C, then queued scans with the next scan on the bus while the
+ * previous one is collected and processed.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "KeyboardMatrixController.h"
+#include "test.h"
+
+static const uint8_t ADDRESSES[2] = { 0x20, 0x21 };
+
+// rows per column of one scan: expander 0 columns 0-7, expander 1 columns 8-15
+struct Keys {
+	uint8_t cols[16];
+
+	Keys() {
+		memset(cols, 0, sizeof(cols));
+	}
+
+	Keys& press(const int col, const int row) {
+		cols[col] |= 1 << row;
+		return *this;
+	}
+
+	void apply() const {
+		uint8_t rows[8];
+		for (int n = 0; n < 2; n++) {
+			memcpy(rows, cols + n*8, 8);
+			FakeI2CBus::setKeys(ADDRESSES[n], rows);
+		}
+	}
+};
+
+struct Matrix {
+	I2C i2c;
+	I2CTransactionQueue queue;
+	KeyboardMatrixController<2> controller;
+
+	Matrix() : i2c(NC, NC), controller(i2c, ADDRESSES) {
+		FakeI2CBus::reset();
+		for (int n = 0; n < 2; n++) FakeI2CBus::attach(ADDRESSES[n]);
+		Keys().apply();
+		controller.init();
+		FakeI2CBus::clearTrace();
+	}
+
+	// ISR steps until the scan is finished
+	void finish() {
+		FakeI2CBus::run(I2CTransactionQueue::irq);
+	}
+};
+
+static bool same(const Keys& expected, const uint8_t* keys) {
+	return !memcmp(expected.cols, keys, sizeof(expected.cols));
+}
+
+TEST(setup_selects_byte_mode) {
+	Matrix m;
+	CHECK(m.controller.expanderReady(0));
+	CHECK(m.controller.expanderReady(1));
+	// MIRROR | SEQOP | ODR, at both IOCON addresses
+	CHECK_EQ(0x64, FakeI2CBus::reg(0x20, 0x0a));
+	CHECK_EQ(0x64, FakeI2CBus::reg(0x21, 0x0b));
+	CHECK_EQ(0xff, FakeI2CBus::reg(0x20, 0x03));
+}
+
+TEST(column_read_toggles_to_gpiob) {
+	Matrix m;
+	Keys().press(2, 5).apply();
+	int error;
+	MCP23017 gpio(m.i2c, 0x20);
+	CHECK_EQ(0x20, gpio.write8read8(MCP23017::GPIOA, ~(1<<2), error));
+	CHECK_EQ(0, error);
+	CHECK_STR("S W20 A 12 A fb A Sr R20 A r20 N P", FakeI2CBus::trace());
+	CHECK_EQ(0, gpio.write8read8(MCP23017::GPIOA, ~(1<<3), error));
+
+	// the pointer stays in the GPIOA / GPIOB pair
+	FakeI2CBus::clearTrace();
+	const char reg = MCP23017::GPIOA;
+	char data[3];
+	CHECK_EQ(0, m.i2c.write(0x40, &reg, 1, true));
+	CHECK_EQ(0, m.i2c.read(0x40, data, 3));
+	CHECK_STR("S W20 A 12 A Sr R20 A rf7 A r00 A rf7 N P", FakeI2CBus::trace());
+}
+
+TEST(queued_scan) {
+	Matrix m;
+	Keys expected;
+	expected.press(0, 0).press(2, 5).press(2, 7).press(9, 1).press(15, 3);
+	expected.apply();
+
+	m.controller.startScan(m.queue);
+	CHECK(!m.controller.scanCompleted());
+	m.finish();
+	CHECK(m.controller.scanCompleted());
+
+	uint8_t keys[16];
+	m.controller.collectScan(keys);
+	CHECK(same(expected, keys));
+	CHECK_EQ(0, m.controller.expanderStatus(0).errors);
+	CHECK_EQ(0, m.controller.expanderStatus(1).errors);
+	// idle: all columns driven low with the interrupt enabled
+	CHECK_EQ(0x00, FakeI2CBus::reg(0x20, 0x12));
+	CHECK_EQ(0xff, FakeI2CBus::reg(0x21, 0x05));
+}
+
+TEST(next_scan_while_processing) {
+	Matrix m;
+	Keys frames[4];
+	frames[0].press(1, 1);
+	frames[1].press(1, 1).press(12, 6);
+	frames[2].press(12, 6);
+	// frames[3]: released
+
+	frames[0].apply();
+	m.controller.startScan(m.queue);
+	m.finish();
+
+	uint8_t keys[16];
+	for (int n = 0; n < 4; n++) {
+		CHECK(m.controller.scanCompleted());
+		m.controller.collectScan(keys);
+
+		// scan n+1 runs while scan n is processed
+		if (n + 1 < 4) frames[n + 1].apply();
+		m.controller.startScan(m.queue);
+		for (int i = 0; i < 10; i++) I2CTransactionQueue::irq();
+		CHECK(!m.controller.scanCompleted());
+
+		CHECK(same(frames[n], keys));
+		m.finish();
+	}
+	CHECK(same(Keys(), keys));
+	CHECK_EQ(0, m.controller.expanderStatus(0).errors);
+	CHECK_EQ(0, m.controller.expanderStatus(1).errors);
+}
+
+TEST(reset_expander_is_set_up_again) {
+	Matrix m;
+	m.controller.setVerifyInterval(1);
+	// power-on reset of the second expander: registers cleared
+	FakeI2CBus::attach(0x21);
+	Keys expected;
+	expected.press(9, 1).apply();
+
+	m.controller.startScan(m.queue);
+	m.finish();
+	uint8_t keys[16];
+	m.controller.collectScan(keys);
+	CHECK(same(expected, keys));
+	CHECK_EQ(0, m.controller.expanderStatus(0).resets);
+	CHECK_EQ(1, m.controller.expanderStatus(1).resets);
+	CHECK_EQ(0x64, FakeI2CBus::reg(0x21, 0x0a));
+}
+
+int main() {
+	return runTests();
+}
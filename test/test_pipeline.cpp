@@ -0,0 +1,149 @@
+/**
+ * Scan -> debounce -> keymap -> HID reports on the simulated matrix,
+ * checked at the host side of the fake USB controller.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#include "keymap.h"
+#include "HostKeyboard.h"
+#include "test.h"
+
+static const HostReport* reports[HostKeyboard<>::MAX_REPORTS];
+
+TEST(enumerates) {
+	HostKeyboard<> host;
+	CHECK(FakeUSBHost::connected());
+	CHECK(host.usb.configured());
+}
+
+TEST(configuration_without_usb_ram_fails) {
+	// keyboard IN and OUT endpoints need 2 x 2 x 64 bytes
+	FakeUSBHost::usbRam(3 * 64);
+	HostKeyboard<> host;
+	CHECK(!host.usb.configured());
+	// SET_CONFIGURATION stalled, the device is still running
+	CHECK(!FakeUSBHost::enumerate());
+	USBHAL::USB_RAM_USAGE usage;
+	USBHAL::usbRamUsage(&usage);
+	CHECK_EQ(2, usage.failed);
+
+	FakeUSBHost::usbRam(4 * 64);
+	CHECK(FakeUSBHost::enumerate());
+	CHECK(host.usb.configured());
+	FakeUSBHost::usbRam(0);
+}
+
+TEST(bouncing_key_is_one_press) {
+	HostKeyboard<> host;
+	CHECK(host.load(
+		"10  3 1 d\n"
+		"11  3 1 u\n"
+		"12  3 1 d\n"
+		"13  3 1 u\n"
+		"14  3 1 d\n"
+		"100 3 1 u\n"
+		"101 3 1 d\n"
+		"102 3 1 u\n"
+	));
+	host.runScript();
+
+	const int n = host.keyboardReports(reports, HostKeyboard<>::MAX_REPORTS);
+	CHECK_EQ(2, n);
+	if (n != 2) return;
+	CHECK(reports[0]->pressed(KEY_a_A));
+	CHECK_EQ(1, reports[0]->count());
+	CHECK_EQ(0, reports[1]->count());
+	CHECK(reports[0]->frame >= 14);
+	CHECK(reports[1]->frame >= 100);
+}
+
+TEST(keys_on_same_scan_keep_order) {
+	HostKeyboard<> host;
+	CHECK(host.load(
+		"10  3 1 d\n"
+		"10  3 2 d\n"
+		"50  3 1 u\n"
+		"50  3 2 u\n"
+	));
+	host.runScript();
+
+	const int n = host.keyboardReports(reports, HostKeyboard<>::MAX_REPORTS);
+	CHECK_EQ(4, n);
+	if (n != 4) return;
+	// a report per key event, not one merged report
+	CHECK(reports[0]->pressed(KEY_a_A) && !reports[0]->pressed(KEY_s_S));
+	CHECK(reports[1]->pressed(KEY_a_A) && reports[1]->pressed(KEY_s_S));
+	CHECK(!reports[2]->pressed(KEY_a_A) && reports[2]->pressed(KEY_s_S));
+	CHECK_EQ(0, reports[3]->count());
+	// one report per polling interval
+	for (int i = 1; i < n; i++) {
+		CHECK(reports[i]->frame - reports[i - 1]->frame >= USB_POLLING_INTERVAL_MS);
+	}
+}
+
+TEST(latency_in_frames) {
+	HostKeyboard<> host;
+	CHECK(host.load(
+		"30  3 1 d\n"
+		"70  3 1 u\n"
+	));
+	// empty keyboard, consumer and system reports after configuration
+	host.keyboard.queueCurrentReportData();
+	host.run(10);
+	host.keyboard.resetLatencyHistogram();
+	host.runScript();
+
+	// press and release, each in the frame after its scan at the latest
+	const MyUSBKeyboard::LatencyHistogram& latency = host.keyboard.latencyHistogram();
+	CHECK_EQ(2, latency.counts[0] + latency.counts[1]);
+	for (int i = 2; i < MyUSBKeyboard::LATENCY_BUCKETS; i++) CHECK_EQ(0, latency.counts[i]);
+	CHECK(host.keyboard.inTokenPhase() >= 0);
+}
+
+TEST(momentary_layer) {
+	HostKeyboard<> host;
+	CHECK(host.load(
+		"10  5 14 d\n"
+		"30  2 14 d\n"
+		"50  2 14 u\n"
+		"70  5 14 u\n"
+		"90  2 14 d\n"
+		"110 2 14 u\n"
+	));
+	host.runScript();
+
+	const int n = host.keyboardReports(reports, HostKeyboard<>::MAX_REPORTS);
+	CHECK_EQ(4, n);
+	if (n != 4) return;
+	CHECK(reports[0]->pressed(KEY_UpArrow));
+	CHECK_EQ(0, reports[1]->count());
+	CHECK(reports[2]->pressed(KEY_LeftBracket_LeftBrace));
+	CHECK_EQ(0, reports[3]->count());
+}
+
+TEST(consumer_key) {
+	HostKeyboard<> host;
+	CHECK(host.load(
+		"10  5 5 d\n"
+		"50  5 5 u\n"
+	));
+	host.runScript();
+
+	int presses = 0, releases = 0;
+	for (int i = 0; i < host.reportCount; i++) {
+		const HostReport& r = host.reports[i];
+		if (r.keyboard()) continue;
+		if (r.data[0] != 3) continue; // REPORT_ID_CONSUMER
+		const uint16_t usage = r.data[1] | (r.data[2] << 8);
+		if (usage == CONSUMER_PLAY_PAUSE) presses++;
+		if (usage == 0) releases++;
+	}
+	CHECK_EQ(1, presses);
+	CHECK_EQ(1, releases);
+}
+
+int main() {
+	return runTests();
+}
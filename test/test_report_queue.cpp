@@ -0,0 +1,147 @@
+/**
+ * MyUSBKeyboard report queue while the host does not poll: a full queue
+ * must neither reorder changes nor lose a press.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#include "keymap.h"
+#include "HostKeyboard.h"
+#include "test.h"
+
+// reports the queue holds, in flight ones included
+static const int CAPACITY = REPORT_QUEUE_SIZE;
+
+static const uint8_t KEYS[] = { KEY_a_A, KEY_b_B, KEY_c_C, KEY_d_D, KEY_e_E, KEY_f_F, KEY_g_G, KEY_h_H, KEY_i_I, KEY_j_J };
+typedef char KEYS_CHECK[sizeof(KEYS) > CAPACITY ? 1 : -1];
+
+// empty keyboard, consumer and system reports after configuration sent
+static void idle(HostKeyboard<>& host) {
+	host.keyboard.queueCurrentReportData();
+	host.run(10);
+	host.reportCount = 0;
+}
+
+static uint32_t merged(HostKeyboard<>& host) {
+	return host.keyboard.reportQueueStats().merged;
+}
+
+static void press(HostKeyboard<>& host, const uint8_t code) {
+	host.keyboard.appendReportData(code);
+	host.keyboard.queueCurrentReportData();
+}
+
+static void release(HostKeyboard<>& host, const uint8_t code) {
+	host.keyboard.deleteReportData(code);
+	host.keyboard.queueCurrentReportData();
+}
+
+static void pressConsumer(HostKeyboard<>& host, const uint16_t usage) {
+	host.keyboard.appendConsumerData(usage);
+	host.keyboard.queueCurrentReportData();
+}
+
+static bool isConsumer(const HostReport& report, const uint16_t usage) {
+	return report.data[0] == 3 && report.data[1] == LSB(usage) && report.data[2] == MSB(usage);
+}
+
+// index of the first report the host got matching, -1 when none
+static int findKeyboard(const HostKeyboard<>& host, const uint8_t code, const bool down) {
+	for (int i = 0; i < host.reportCount; i++) {
+		const HostReport& r = host.reports[i];
+		if (r.keyboard() && r.pressed(code) == down) return i;
+	}
+	return -1;
+}
+
+static int findConsumer(const HostKeyboard<>& host, const uint16_t usage) {
+	for (int i = 0; i < host.reportCount; i++) {
+		if (isConsumer(host.reports[i], usage)) return i;
+	}
+	return -1;
+}
+
+TEST(every_change_fits) {
+	HostKeyboard<> host;
+	idle(host);
+	for (int i = 0; i < CAPACITY; i++) press(host, KEYS[i]);
+	host.run(50);
+	CHECK_EQ(CAPACITY, host.reportCount);
+	CHECK_EQ(0, merged(host));
+}
+
+TEST(full_queue_merges_into_newest_report) {
+	HostKeyboard<> host;
+	idle(host);
+	for (int i = 0; i < CAPACITY; i++) press(host, KEYS[i]);
+	press(host, KEYS[CAPACITY]);
+	CHECK_EQ(1, merged(host));
+	host.run(50);
+	CHECK_EQ(CAPACITY, host.reportCount);
+	// newest report holds both last presses
+	CHECK(host.reports[CAPACITY - 1].pressed(KEYS[CAPACITY - 1]));
+	CHECK(host.reports[CAPACITY - 1].pressed(KEYS[CAPACITY]));
+}
+
+TEST(release_does_not_replace_press_behind_other_kind) {
+	// keyboard reports, then consumer report as the newest, queue full
+	HostKeyboard<> host;
+	idle(host);
+	const uint8_t key = KEYS[CAPACITY - 2];
+	for (int i = 0; i < CAPACITY - 1; i++) press(host, KEYS[i]);
+	pressConsumer(host, CONSUMER_PLAY_PAUSE);
+	release(host, key);
+	host.run(50);
+
+	const int down = findKeyboard(host, key, true);
+	const int play = findConsumer(host, CONSUMER_PLAY_PAUSE);
+	CHECK(down >= 0);
+	CHECK(play > down);
+	// release follows, after the consumer report
+	int up = -1;
+	for (int i = down + 1; i < host.reportCount; i++) {
+		if (host.reports[i].keyboard() && !host.reports[i].pressed(key)) up = i;
+	}
+	CHECK(up > play);
+}
+
+TEST(later_change_does_not_overtake_pending_one) {
+	// keyboard reports fill the queue, consumer press does not fit
+	HostKeyboard<> host;
+	idle(host);
+	for (int i = 0; i < CAPACITY; i++) press(host, KEYS[i]);
+	pressConsumer(host, CONSUMER_PLAY_PAUSE);
+	// would fit by merging into the newest keyboard report, but the
+	// consumer change is older
+	press(host, KEYS[CAPACITY]);
+	host.run(50);
+
+	const int play = findConsumer(host, CONSUMER_PLAY_PAUSE);
+	const int last = findKeyboard(host, KEYS[CAPACITY], true);
+	CHECK(play >= 0);
+	CHECK(last > play);
+	// all keys were pressed by the host in the end
+	const HostReport* reports[HostKeyboard<>::MAX_REPORTS];
+	const int n = host.keyboardReports(reports, HostKeyboard<>::MAX_REPORTS);
+	CHECK(n > 0 && reports[n - 1]->count() == CAPACITY + 1);
+}
+
+TEST(set_protocol_drops_queued_reports) {
+	HostKeyboard<> host;
+	idle(host);
+	for (int i = 0; i < 4; i++) press(host, KEYS[i]);
+	// SET_PROTOCOL(boot) to interface 0
+	CHECK(FakeUSBHost::control(0x21, SET_PROTOCOL, HID_BOOT_PROTOCOL, 0, NULL, 0) >= 0);
+	host.keyboard.queueCurrentReportData();
+	host.run(10);
+	// the two reports on the IN endpoint, then the keys in boot format
+	CHECK_EQ(3, host.reportCount);
+	CHECK(!host.reports[1].boot());
+	CHECK(host.reports[2].boot());
+	CHECK_EQ(4, host.reports[2].count());
+}
+
+int main() {
+	return runTests();
+}
@@ -0,0 +1,113 @@
+/**
+ * ScanScheduler mode changes, wakeup() from the MCP23017 interrupt and
+ * fast scans synced to USB SOF and phase locked to the host IN token.
+ */
+#include "mbed.h"
+#include "ScanScheduler.h"
+#include "test.h"
+
+static const uint32_t FAST_US = 4000;
+static const uint32_t SLOW_US = 20000;
+static const uint32_t SLOW_AFTER_MS = 100;
+static const uint32_t STOP_AFTER_MS = 1000;
+
+// fast scanning started at 0ms, idle since
+struct Scheduler : ScanScheduler {
+	Scheduler() : ScanScheduler(FAST_US, SLOW_US, SLOW_AFTER_MS, STOP_AFTER_MS) {
+		start(0);
+		due();
+	}
+
+	// one idle scan at ms
+	void idleScan(const uint32_t ms) {
+		due();
+		scanned(false, ms);
+	}
+};
+
+TEST(fast_until_slow_after) {
+	Scheduler s;
+	s.idleScan(SLOW_AFTER_MS - 1);
+	CHECK_EQ(ScanScheduler::MODE_FAST, s.currentMode());
+	s.idleScan(SLOW_AFTER_MS);
+	CHECK_EQ(ScanScheduler::MODE_SLOW, s.currentMode());
+	CHECK_EQ(SLOW_US, s.interval());
+	s.idleScan(STOP_AFTER_MS);
+	CHECK_EQ(ScanScheduler::MODE_INTERRUPT, s.currentMode());
+}
+
+TEST(wakeup_in_slow_mode_scans_at_once) {
+	Scheduler s;
+	s.idleScan(SLOW_AFTER_MS);
+	CHECK_EQ(ScanScheduler::MODE_SLOW, s.currentMode());
+	CHECK(!s.due());
+	s.wakeup();
+	CHECK(s.due());
+	// the key keeps fast scanning
+	s.scanned(false, SLOW_AFTER_MS + 5);
+	CHECK_EQ(ScanScheduler::MODE_FAST, s.currentMode());
+}
+
+TEST(wakeup_in_interrupt_mode_scans_at_once) {
+	Scheduler s;
+	s.idleScan(STOP_AFTER_MS);
+	CHECK_EQ(ScanScheduler::MODE_INTERRUPT, s.currentMode());
+	CHECK(!s.due());
+	s.wakeup();
+	CHECK(s.due());
+	s.scanned(false, STOP_AFTER_MS + 5);
+	CHECK_EQ(ScanScheduler::MODE_FAST, s.currentMode());
+}
+
+TEST(wakeup_in_fast_mode_waits_for_tick) {
+	Scheduler s;
+	s.idleScan(10);
+	s.wakeup();
+	CHECK(!s.due());
+	// but restarts the idle time
+	s.scanned(false, SLOW_AFTER_MS + 5);
+	CHECK_EQ(ScanScheduler::MODE_FAST, s.currentMode());
+}
+
+TEST(sof_sync_scans_every_nth_frame) {
+	Scheduler s;
+	s.setSofSync(true);
+	for (uint32_t frame = 1; frame < FAST_US / 1000; frame++) {
+		s.sof();
+		CHECK(!s.due());
+	}
+	s.sof();
+	CHECK(s.due());
+}
+
+TEST(sof_sync_only_in_fast_mode) {
+	Scheduler s;
+	s.setSofSync(true);
+	s.idleScan(SLOW_AFTER_MS);
+	CHECK_EQ(ScanScheduler::MODE_SLOW, s.currentMode());
+	for (uint32_t frame = 0; frame < FAST_US / 1000; frame++) s.sof();
+	CHECK(!s.due());
+}
+
+TEST(phase_lock_ends_scan_before_in_token) {
+	Scheduler s;
+	s.setSofSync(true);
+	// scan, keymap and queueing took 300us
+	for (uint32_t frame = 0; frame < FAST_US / 1000; frame++) s.sof();
+	fakeTime() = 10000;
+	CHECK(s.due());
+	fakeTime() = 10300;
+	s.scanned(false, 10);
+	CHECK_EQ(300, s.busyTime());
+
+	s.setPhaseLock(true, 100);
+	s.setTargetPhase(800);
+	CHECK_EQ(800 - 300 - 100, s.scanStartPhase());
+	// the SOF of the scan frame starts the Timeout, not the scan
+	for (uint32_t frame = 0; frame < FAST_US / 1000; frame++) s.sof();
+	CHECK(!s.due());
+}
+
+int main() {
+	return runTests();
+}
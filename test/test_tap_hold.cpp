@@ -0,0 +1,90 @@
+/**
+ * Tap-hold keys through the whole pipeline: the host must see every
+ * replayed event, in order, after the tap / hold decision.
+ */
+#include "mbed.h"
+#include "config.h"
+#include "USBComposite.h"
+#include "MyUSBKeyboard.h"
+#define KEYMAP_DEFINITION_EXTERNAL
+#include "keymap.h"
+#include "HostKeyboard.h"
+#include "test.h"
+
+// row 0: MT(ctrl, x), c, LT(1, z), a   layer 1: b on col 3
+const keyaction_t Keymap::KEYMAP_DEFINITION[LAYERS][ROWS][COLS] = {
+	{
+		{ MT(_ctrlL, _X), _C, LT(1, _Z), _A },
+	},
+	{
+		{ KEY_ACTION_TRANSPARENT, KEY_ACTION_TRANSPARENT, KEY_ACTION_TRANSPARENT, _B },
+	},
+};
+
+TEST(tap) {
+	HostKeyboard<> host;
+	host.load(
+		"10  0 0 d\n"
+		"50  0 0 u\n"
+	);
+	host.runScript();
+	CHECK_STR("1b -", host.keySequence());
+}
+
+TEST(hold_with_key_tapped_inside_is_ctrl_c) {
+	// PERMISSIVE_HOLD: c pressed and released while MT is held
+	HostKeyboard<> host;
+	host.load(
+		"10  0 0 d\n"
+		"30  0 1 d\n"
+		"50  0 1 u\n"
+		"70  0 0 u\n"
+	);
+	host.runScript();
+	CHECK_STR("e0 06+e0 e0 -", host.keySequence());
+}
+
+TEST(tap_with_key_rolled_over_keeps_order) {
+	// MT released while c is still down: tap, then c
+	HostKeyboard<> host;
+	host.load(
+		"10  0 0 d\n"
+		"30  0 1 d\n"
+		"50  0 0 u\n"
+		"70  0 1 u\n"
+	);
+	host.runScript();
+	CHECK_STR("1b 06+1b 06 -", host.keySequence());
+}
+
+TEST(hold_after_tapping_term) {
+	HostKeyboard<> host;
+	host.load(
+		"10  0 0 d\n"
+		"300 0 1 d\n"
+		"320 0 1 u\n"
+		"340 0 0 u\n"
+	);
+	host.runScript();
+	CHECK_STR("e0 06+e0 e0 -", host.keySequence());
+
+	const HostReport* reports[4];
+	const int n = host.keyboardReports(reports, 4);
+	CHECK(n >= 1 && reports[0]->frame >= 10 + TAPPING_TERM_MS);
+}
+
+TEST(layer_tap_hold) {
+	HostKeyboard<> host;
+	host.load(
+		"10  0 2 d\n"
+		"30  0 3 d\n"
+		"50  0 3 u\n"
+		"70  0 2 u\n"
+	);
+	host.runScript();
+	CHECK_STR("05 -", host.keySequence());
+}
+
+int main() {
+	return runTests();
+}